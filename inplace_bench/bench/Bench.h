@@ -1,6 +1,10 @@
+#include <new>
 #include <utility>
 
+#include "utils/bench/BenchClock.h"
 #include "utils/bench/BenchEnv.h"
+#include "utils/bench/BenchSwitch.h"
+#include "utils/bench/BenchSampling.h"
 
 namespace bench {
 
@@ -16,6 +20,7 @@ namespace bench {
  * This class compute the time taken between its creation and the call to 
  * its destruction.
  * The elapsed time is added to the accumulator given as argument.
+ * The time is read from `Clock` (see BenchClock.h).
  * 
  * @Example ```
 *       std::chrono::nanoseconds elapsed;
@@ -25,7 +30,7 @@ namespace bench {
  *      } // when leaving this scope elapsed contains the time taken by `Do stuff`
  *         ```
  */
-template <typename DurationT>
+template <typename DurationT, typename Clock = DefaultBenchClock>
 struct ScopedTimer {
     constexpr explicit ScopedTimer(DurationT& acc_)
         : acc(acc_)
@@ -33,12 +38,12 @@ struct ScopedTimer {
             // Initialisation order in initializer list is undefined. We setup
             // `_start` here in order to make sure it is not assigned before
             // constructing the `_infos` object.
-            start = std::chrono::steady_clock::now();
+            start = Clock::start();
         }
 
     FORCEINLINE ~ScopedTimer() {
-        auto end = std::chrono::steady_clock::now();
-        acc += end - start;
+        auto end = Clock::stop();
+        acc += Clock::elapsed(start, end);
     }
 
     ScopedTimer(const ScopedTimer&) = delete;
@@ -47,7 +52,7 @@ struct ScopedTimer {
     ScopedTimer& operator=(ScopedTimer&&) = delete;
 
     DurationT& acc;
-    std::chrono::time_point<std::chrono::steady_clock> start;
+    typename Clock::tick_t start;
 };
 
 // ---------------
@@ -60,6 +65,45 @@ ScopedTimer(DurationT& acc_) -> ScopedTimer<DurationT>;
 // Bench computing classes
 // -----------------------
 
+/**
+ * Store where the bench object was created when the infos need it to merge
+ * repeated benches (see `AggregatedBenchInfos`).
+ */
+template <typename Infos>
+constexpr void setCallSite(Infos& infos, const char* file, unsigned line) {
+    if constexpr (is_aggregated_v<Infos>) {
+        infos.file = file;
+        infos.line = line;
+    }
+}
+
+/**
+ * Keep the name and the start of the bench for the trace export when
+ * ALGOLIA_PROFILING_TRACE is enabled (see BenchTrace.h). Both are only stored
+ * so that no extra clock read is needed. `Clock::timestamp` gives the start on
+ * the steady_clock timeline, whichever the clock of the bench object.
+ */
+template <typename Infos>
+constexpr void setTraceName(Infos& infos, const char* name) {
+    if constexpr (std::is_same_v<TraceStamp_t, TraceStamp>) {
+        infos.trace.name = name;
+    }
+}
+
+template <typename Clock, typename Infos>
+FORCEINLINE void setTraceStart(Infos& infos, typename Clock::tick_t start) {
+    if constexpr (std::is_same_v<TraceStamp_t, TraceStamp>) {
+        infos.trace.start = Clock::timestamp(start);
+    }
+}
+
+template <typename Infos>
+FORCEINLINE void setTraceDuration(Infos& infos, std::chrono::nanoseconds duration) {
+    if constexpr (std::is_same_v<TraceStamp_t, TraceStamp>) {
+        infos.trace.duration = duration.count();
+    }
+}
+
 /**
  * Benchmark a task represented by `_task`. On destruction, the object
  * add its `BenchInfos` object to the `BenchEnv` instance.
@@ -80,38 +124,97 @@ ScopedTimer(DurationT& acc_) -> ScopedTimer<DurationT>;
  * @Note Once created, a benchTask object cannot change its task. This helps
  *       the compiler inline the task and avoid having overhead from the call.
  */
-template <typename Task, typename Infos = BenchInfos>
+template <typename Task, typename Infos = DefaultBenchInfos,
+          typename Clock = DefaultBenchClock>
 class BenchTask {
 public:
     CLASS_NON_COPYABLE(BenchTask);
 
     template <std::size_t N>
-    constexpr BenchTask(const char (&name)[N], const Task task)
-        : _infos{{}, name, {}},
-          _task(task) {}
+    constexpr BenchTask(const char (&name)[N], const Task task,
+                        Category category = category::main,
+                        const char* file = __builtin_FILE(),
+                        unsigned line = __builtin_LINE())
+        : _infos(name),
+          _task(task),
+          _enabled(isProfilingEnabled(category)) {
+            setCallSite(_infos, file, line);
+            setTraceName(_infos, name);
+        }
 
-    BenchTask(BenchTask&& o) = default;
+    BenchTask(BenchTask&& o)
+        : _infos(std::move(o._infos)),
+          _task(o._task),
+          _firstStart(o._firstStart),
+          _ran(o._ran),
+          _enabled(o._enabled),
+          _pin(std::move(o._pin)) {
+            _pin.moved(o._infos, _infos);
+        }
     BenchTask& operator=(BenchTask&& o) = default;
 
     ~BenchTask() {
+        if (!_enabled) {
+            return;
+        }
+
+        // The trace event starts with the first run
+        setTraceStart<Clock>(_infos, _firstStart);
+        setTraceDuration(_infos, _infos.elapsed);
         auto& env = getEnvInstance<Infos>();
         env.addLeaf(std::move(_infos));
+        _pin.unpin(_infos);
     }
 
     template <typename... Args>
     constexpr auto run(Args&&... args) {
-        ScopedTimer timer(_infos.elapsed);
+        if (!_enabled) {
+            return _task(std::forward<Args>(args)...);
+        }
+
+        ScopedOverhead overhead(_infos.overhead, _infos.elapsed);
+        ScopedCounters counters(_infos.counters);
+        ScopedAllocations allocations(_infos.allocations);
+        ScopedCpuTime cpuTime(_infos.cpuTime);
+        ScopedTimer<decltype(_infos.elapsed), Clock> timer(_infos.elapsed);
+        if (!_ran) {
+            _firstStart = timer.start;
+            _ran = true;
+        }
         return _task(std::forward<Args>(args)...);
     }
 
     template <typename Key, typename Value>
     void addComment(Key&& key, Value&& value) {
-        _infos.addComment(std::forward<Key>(key), std::forward<Value>(value));
+        if (_enabled) {
+            _pin.pin(_infos);
+            _infos.addComment(std::forward<Key>(key), std::forward<Value>(value));
+        }
     }
 
+    /**
+     * Add `value` to the metric `key`, whose rate over the elapsed time is
+     * dumped. The calls of the same key are summed.
+     */
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&key)[N], Value value) {
+        if (_enabled) {
+            _pin.pin(_infos);
+            _infos.addCounter(key, value);
+        }
+    }
+
+    // Count processed items, their throughput and time per item are dumped
+    template <typename Value>
+    void addItems(Value n) { addCounter(itemsMetric, n); }
+
 private:
     Infos _infos;
     const Task _task;
+    typename Clock::tick_t _firstStart{};
+    bool _ran = false;
+    bool _enabled; // See BenchSwitch.h
+    ArenaPin<Infos> _pin; // The comments and the metrics live in the arena
 };
 
 /**
@@ -128,25 +231,70 @@ private:
  *    }
  *          ```
  */
-template <typename Infos = BenchInfos>
+template <typename Infos = DefaultBenchInfos, typename Clock = DefaultBenchClock>
 class BenchScope {
 public:
 
     template<std::size_t N>
-    constexpr BenchScope(const char (&name)[N])
-        : _infos{{}, name, {}} {
+    constexpr BenchScope(const char (&name)[N],
+                         Category category = category::main,
+                         const char* file = __builtin_FILE(),
+                         unsigned line = __builtin_LINE())
+        : BenchScope(name, Sampled{1}, category, file, line) {}
+
+    /**
+     * Measure one execution standing for `sampled.rate` ones, see
+     * `SampledBenchScope`.
+     */
+    template<std::size_t N>
+    constexpr BenchScope(const char (&name)[N], Sampled sampled,
+                         Category category = category::main,
+                         const char* file = __builtin_FILE(),
+                         unsigned line = __builtin_LINE())
+        : _sampling(sampled.rate),
+          _enabled(isProfilingEnabled(category)) {
+            if (!_enabled) {
+                return;
+            }
+
+            new (&_infos) Infos(name);
+            setCallSite(_infos, file, line);
+            setTraceName(_infos, name);
+            _recordedAtStart = nbRecordedBenches;
+            _recordedTimeAtStart = recordedTime;
+            _startCounters = readCounters();
+            _startAllocations = readAllocations();
+            _startCpuTime = readCpuTime();
             // Initialisation order in initializer list is undefined. We setup
             // `_start` here in order to make sure it is not assigned before
             // constructing the `_infos` object.
-            _start = std::chrono::steady_clock::now(); 
+            _start = Clock::start(); 
         }
         
     FORCEINLINE ~BenchScope() {
-        auto end = std::chrono::steady_clock::now();
-        _infos.elapsed += end - _start;
+        if (!_enabled) {
+            return;
+        }
+
+        auto end = Clock::stop();
+        _infos.elapsed += Clock::elapsed(_start, end);
+        _infos.counters += readCounters() - _startCounters;
+        _infos.allocations += readAllocations() - _startAllocations;
+        _infos.cpuTime += readCpuTime() - _startCpuTime;
+        countMeasure(_infos.overhead, _recordedAtStart);
+        countNestedTime(_infos.overhead, _recordedTimeAtStart, _infos.elapsed);
+        setTraceStart<Clock>(_infos, _start);
+        setTraceDuration(_infos, _infos.elapsed); // Before the sample is scaled
+
+        if (_sampling != 1) {
+            _pin.pin(_infos);
+            scaleSample(_infos, _sampling);
+        }
 
         auto& env = getEnvInstance<Infos>();
         env.addLeaf(std::move(_infos));
+        _pin.unpin(_infos);
+        _infos.~Infos();
     }
 
     BenchScope(const BenchScope&) = delete;
@@ -156,17 +304,118 @@ public:
 
     template <typename Key, typename Value>
     constexpr void addComment(Key&& key, Value&& value) {
+        if (!_enabled) {
+            return;
+        }
+
         // Do not take into account the time taken to add the comment
-        auto end = std::chrono::steady_clock::now();
-        _infos.elapsed += end - _start;
+        auto end = Clock::stop();
+        _infos.elapsed += Clock::elapsed(_start, end);
+        countMeasure(_infos.overhead, nbRecordedBenches); // One more measure
 
+        _pin.pin(_infos);
         _infos.addComment(std::forward<Key>(key), std::forward<Value>(value));
-        _start = std::chrono::steady_clock::now();
+        _start = Clock::start();
+    }
+
+    /**
+     * Same as `BenchTask::addCounter`. Unlike a comment, the clock is not
+     * paused: a counter is often updated in a loop and costs a few
+     * nanoseconds once created.
+     */
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&key)[N], Value value) {
+        if (!_enabled) {
+            return;
+        }
+
+        _pin.pin(_infos);
+        _infos.addCounter(key, value);
     }
 
+    template <typename Value>
+    void addItems(Value n) { addCounter(itemsMetric, n); }
+
 private:
-    std::chrono::time_point<std::chrono::steady_clock> _start;
-    Infos _infos;
+    typename Clock::tick_t _start;
+    Counters_t _startCounters;
+    Allocations_t _startAllocations;
+    CpuTime_t _startCpuTime;
+    AULong _recordedAtStart = 0; // See `countMeasure`
+    std::chrono::nanoseconds _recordedTimeAtStart{}; // See `countNestedTime`
+    ArenaPin<Infos> _pin; // The comments and the metrics live in the arena
+    const AULong _sampling;
+    const bool _enabled; // See BenchSwitch.h
+    union {
+        Infos _infos; // Only built when enabled
+    };
+};
+
+/**
+ * Same as `BenchScope` but only measure the executions selected by `sampler`,
+ * one out of `sampler.rate()`. The elapsed time (and the counters) of a
+ * measured execution are multiplied by the rate, so that the totals of the
+ * tree are estimates of the real ones. Those nodes hold a "sampling" comment.
+ *
+ * A not selected execution costs a decrement of the sampler. Use the
+ * BENCH_SAMPLED_SCOPE macro to get a sampler per call site and per thread.
+ *
+ * @Example ```
+ *     for (std::size_t i = 0; i < n; ++i) {
+ *        BENCH_SAMPLED_SCOPE("push_back", 256);
+ *        dst.push_back(i);
+ *    }
+ *          ```
+ */
+template <typename Infos = DefaultBenchInfos, typename Clock = DefaultBenchClock>
+class SampledBenchScope {
+public:
+
+    template<std::size_t N>
+    FORCEINLINE SampledBenchScope(const char (&name)[N], Sampler& sampler,
+                                  Category category = category::main,
+                                  const char* file = __builtin_FILE(),
+                                  unsigned line = __builtin_LINE()) {
+        if (const AULong rate = sampler.tick()) {
+            new (&_scope) BenchScope<Infos, Clock>(name, Sampled{rate}, category, file, line);
+            _sampled = true;
+        }
+    }
+
+    FORCEINLINE ~SampledBenchScope() {
+        if (_sampled) {
+            _scope.~BenchScope();
+        }
+    }
+
+    SampledBenchScope(const SampledBenchScope&) = delete;
+    SampledBenchScope(SampledBenchScope&&) = delete;
+    SampledBenchScope& operator=(const SampledBenchScope&) = delete;
+    SampledBenchScope& operator=(SampledBenchScope&&) = delete;
+
+    template <typename Key, typename Value>
+    constexpr void addComment(Key&& key, Value&& value) {
+        if (_sampled) {
+            _scope.addComment(std::forward<Key>(key), std::forward<Value>(value));
+        }
+    }
+
+    // Only counted for a selected execution, and multiplied by the rate
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&key)[N], Value value) {
+        if (_sampled) {
+            _scope.addCounter(key, value);
+        }
+    }
+
+    template <typename Value>
+    void addItems(Value n) { addCounter(itemsMetric, n); }
+
+private:
+    union {
+        BenchScope<Infos, Clock> _scope; // Only built for a selected execution
+    };
+    bool _sampled = false;
 };
 
 /**
@@ -188,35 +437,84 @@ private:
 *      }
 *          ```
 */
-template <typename Infos = BenchInfos>
+template <typename Infos = DefaultBenchInfos>
 class BenchBunch {
 public:
-    using Comments_t = std::vector<typename Infos::Comment_t>;
 
     template <std::size_t N>
-    constexpr BenchBunch(const char (&name)[N]) 
-        : _infos(getEnvInstance<Infos>().emplaceSubLevel(std::chrono::nanoseconds{}, name, Comments_t{})) {}
+    constexpr BenchBunch(const char (&name)[N],
+                         Category category = category::main,
+                         const char* file = __builtin_FILE(),
+                         unsigned line = __builtin_LINE())
+        : _infos(isProfilingEnabled(category) ? &open(name, file, line) : nullptr) {}
+
+    // Closes the level even if the profiling was disabled in the meantime
+    ~BenchBunch() {
+        if (_infos) {
+            getEnvInstance<Infos>().endSubLevel();
+        }
+    }
+
+    BenchBunch(const BenchBunch&) = delete;
+    BenchBunch(BenchBunch&&) = delete;
+    BenchBunch& operator=(const BenchBunch&) = delete;
+    BenchBunch& operator=(BenchBunch&&) = delete;
 
     template <typename Key, typename Value>
     void addComment(Key&& key, Value&& value) {
-        _infos.addComment(std::forward<Key>(key), std::forward<Value>(value));
+        if (_infos) {
+            _infos->addComment(std::forward<Key>(key), std::forward<Value>(value));
+        }
+    }
+
+    // The rates of a bunch are computed over the time of its children
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&key)[N], Value value) {
+        if (_infos) {
+            _infos->addCounter(key, value);
+        }
     }
 
+    template <typename Value>
+    void addItems(Value n) { addCounter(itemsMetric, n); }
+
 private:
-    Infos& _infos;
+    template <std::size_t N>
+    static Infos& open(const char (&name)[N], const char* file, unsigned line) {
+        auto& env = getEnvInstance<Infos>();
+        Infos* infos;
+        if constexpr (is_aggregated_v<Infos>) {
+            Infos tmp(name);
+            setCallSite(tmp, file, line);
+            infos = &env.addSubLevel(std::move(tmp));
+        } else {
+            infos = &env.emplaceSubLevel(std::chrono::nanoseconds{}, name, typename Infos::Comments_t{});
+        }
+
+        // A bunch is not timed, reading the clock is only needed for the trace
+        if constexpr (std::is_same_v<TraceStamp_t, TraceStamp>) {
+            setTraceName(*infos, name);
+            setTraceStart<DefaultBenchClock>(*infos, DefaultBenchClock::start());
+        }
+        return *infos;
+    }
+
+    Infos* _infos; // Null when the profiling is disabled
 };
 
 #else
-template <typename DurationT>
+template <typename DurationT, typename Clock = DefaultBenchClock>
 struct ScopedTimer {};
 
-template <typename Task, typename Infos = BenchInfos>
+template <typename Task, typename Infos = DefaultBenchInfos,
+          typename Clock = DefaultBenchClock>
 class BenchTask {
 public:
     CLASS_NON_COPYABLE(BenchTask);
 
     template <std::size_t N>
-    constexpr BenchTask(const char (&)[N], const Task task)
+    constexpr BenchTask(const char (&)[N], const Task task, Category = category::main,
+                        const char* = nullptr, unsigned = 0)
         : _task(task) {}
 
     BenchTask(BenchTask&& o) = default;
@@ -230,15 +528,26 @@ public:
     template <typename Key, typename Value>
     void addComment(Key&& key, Value&& value) {}
 
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&)[N], Value) {}
+
+    template <typename Value>
+    void addItems(Value) {}
+
 private:
     const Task _task;
 };
 
-template <typename Infos = BenchInfos>
+template <typename Infos = DefaultBenchInfos, typename Clock = DefaultBenchClock>
 class BenchScope {
 public:
     template<std::size_t N>
-    BenchScope(const char (&name)[N]) {}
+    BenchScope(const char (&name)[N], Category = category::main,
+               const char* = nullptr, unsigned = 0) {}
+
+    template<std::size_t N>
+    BenchScope(const char (&name)[N], Sampled, Category = category::main,
+               const char* = nullptr, unsigned = 0) {}
 
     BenchScope(const BenchScope&) = delete;
     BenchScope(BenchScope&&) = delete;
@@ -247,6 +556,34 @@ public:
 
     template <typename Key, typename Value>
     void addComment(Key&& key, Value&& value) {}
+
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&)[N], Value) {}
+
+    template <typename Value>
+    void addItems(Value) {}
+};
+
+template <typename Infos = DefaultBenchInfos, typename Clock = DefaultBenchClock>
+class SampledBenchScope {
+public:
+    template<std::size_t N>
+    SampledBenchScope(const char (&name)[N], Sampler&, Category = category::main,
+                      const char* = nullptr, unsigned = 0) {}
+
+    SampledBenchScope(const SampledBenchScope&) = delete;
+    SampledBenchScope(SampledBenchScope&&) = delete;
+    SampledBenchScope& operator=(const SampledBenchScope&) = delete;
+    SampledBenchScope& operator=(SampledBenchScope&&) = delete;
+
+    template <typename Key, typename Value>
+    void addComment(Key&& key, Value&& value) {}
+
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&)[N], Value) {}
+
+    template <typename Value>
+    void addItems(Value) {}
 };
 
 // ----------------
@@ -256,14 +593,21 @@ template <typename Task, std::size_t N>
 BenchTask(const char (&)[N], const Task)
     -> BenchTask<Task>;
 
-template <typename Infos = BenchInfos>
+template <typename Infos = DefaultBenchInfos>
 class BenchBunch {
 public:
     template <std::size_t N>
-    BenchBunch(const char (&)[N]) {}
+    BenchBunch(const char (&)[N], Category = category::main,
+               const char* = nullptr, unsigned = 0) {}
 
     template <typename Key, typename Value>
     void addComment(Key&& key, Value&& value) {}
+
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&)[N], Value) {}
+
+    template <typename Value>
+    void addItems(Value) {}
 };
 #endif
 
@@ -309,4 +653,21 @@ public:
  */
 #define BENCH_THIS_FUNCTION() ::bench::BenchScope scope(__PRETTY_FUNCTION__)
 
+/**
+ * Same as a `BenchScope` named `NAME` but only measure one execution out of
+ * `RATE` (see `SampledBenchScope`). `RATE` must be a constant.
+ *
+ * @Example ```
+ *      static void hot(std::size_t n) {
+ *          BENCH_SAMPLED_SCOPE("hot", 1024);
+ *          // Do stuff
+ *      }
+ *          ```
+ */
+#define BENCH_SAMPLED_SCOPE(NAME, RATE)                                        \
+    static thread_local ::bench::Sampler benchSampler(RATE);                   \
+    ::bench::SampledBenchScope sampledScope(NAME, benchSampler)
+
+#define BENCH_THIS_FUNCTION_SAMPLED(RATE) BENCH_SAMPLED_SCOPE(__PRETTY_FUNCTION__, RATE)
+
 } // namespace bench
\ No newline at end of file
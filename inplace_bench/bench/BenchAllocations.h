@@ -0,0 +1,155 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <cstddef>
+#include <new>
+
+namespace bench {
+
+#ifndef ALGOLIA_PROFILING_ALLOCATIONS
+    #define ALGOLIA_PROFILING_ALLOCATIONS 0
+#endif
+
+// ---------------------
+// Allocation accounting
+// ---------------------
+
+/**
+ * Heap allocations of a thread through `operator new` and `operator delete`,
+ * counted by the hooks of BENCH_TRACK_ALLOCATIONS. The sizes are the usable
+ * sizes of the blocks, slack of the allocator included, so that a block
+ * weighs the same when allocated and when freed.
+ */
+struct Allocations {
+    AULong count = 0;
+    AULong allocated = 0; // Bytes
+    AULong freed = 0; // Bytes
+
+    Allocations& operator+=(const Allocations& o) {
+        count += o.count;
+        allocated += o.allocated;
+        freed += o.freed;
+        return *this;
+    }
+
+    Allocations& operator*=(AULong factor) {
+        count *= factor;
+        allocated *= factor;
+        freed *= factor;
+        return *this;
+    }
+
+    Allocations operator-(const Allocations& o) const {
+        return { count - o.count, allocated - o.allocated, freed - o.freed };
+    }
+};
+
+/**
+ * Placeholder used instead of `Allocations` when ALGOLIA_PROFILING_ALLOCATIONS
+ * is disabled, so that the infos do not grow.
+ */
+struct NoAllocations {
+    NoAllocations& operator+=(const NoAllocations&) { return *this; }
+    NoAllocations& operator*=(AULong) { return *this; }
+    NoAllocations operator-(const NoAllocations&) const { return {}; }
+};
+
+#if ALGOLIA_PROFILING_ALLOCATIONS == 1
+using Allocations_t = Allocations;
+#else
+using Allocations_t = NoAllocations;
+#endif
+
+// Allocations of the thread since it started, constant initialized: the hooks
+// only cost the access to the thread local storage
+inline thread_local Allocations threadAllocations;
+
+/**
+ * Read the allocations of the calling thread when ALGOLIA_PROFILING_ALLOCATIONS
+ * is enabled, do nothing otherwise.
+ */
+static FORCEINLINE Allocations_t readAllocations() {
+#if ALGOLIA_PROFILING_ALLOCATIONS == 1
+    return threadAllocations;
+#else
+    return {};
+#endif
+}
+
+/**
+ * Add to `acc` the allocations made between its creation and its
+ * destruction. Same as `ScopedCounters` for the allocations.
+ */
+struct ScopedAllocations {
+    explicit ScopedAllocations(Allocations_t& acc_)
+        : acc(acc_), start(readAllocations()) {}
+
+    FORCEINLINE ~ScopedAllocations() {
+        acc += readAllocations() - start;
+    }
+
+    ScopedAllocations(const ScopedAllocations&) = delete;
+    ScopedAllocations(ScopedAllocations&&) = delete;
+    ScopedAllocations& operator=(const ScopedAllocations&) = delete;
+    ScopedAllocations& operator=(ScopedAllocations&&) = delete;
+
+    Allocations_t& acc;
+    const Allocations_t start;
+};
+
+namespace details {
+    // The hooks only go through malloc and the thread local counters
+    static FORCEINLINE void* trackedNew(std::size_t size) {
+        void* p = malloc(size ? size : 1);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        auto& allocations = threadAllocations;
+        ++allocations.count;
+        allocations.allocated += malloc_usable_size(p);
+        return p;
+    }
+
+    static FORCEINLINE void trackedDelete(void* p) {
+        if (p) {
+            threadAllocations.freed += malloc_usable_size(p);
+            free(p);
+        }
+    }
+} // namespace details
+
+/**
+ * Replace the global `operator new` and `operator delete` by hooks counting
+ * the allocations of each thread (see `Allocations`). To be used once, at
+ * namespace scope in a single translation unit of the program, along with
+ * ALGOLIA_PROFILING_ALLOCATIONS set to 1 so that the bench objects read the
+ * counters. The nothrow versions of the standard library go through those
+ * hooks, the over-aligned versions are not counted.
+ *
+ * @Note malloc and free called directly are not counted.
+ */
+#define BENCH_TRACK_ALLOCATIONS()                                              \
+    void* operator new(std::size_t size) {                                     \
+        return ::bench::details::trackedNew(size);                             \
+    }                                                                          \
+    void* operator new[](std::size_t size) {                                   \
+        return ::bench::details::trackedNew(size);                             \
+    }                                                                          \
+    void operator delete(void* p) noexcept {                                   \
+        ::bench::details::trackedDelete(p);                                    \
+    }                                                                          \
+    void operator delete[](void* p) noexcept {                                 \
+        ::bench::details::trackedDelete(p);                                    \
+    }                                                                          \
+    void operator delete(void* p, std::size_t) noexcept {                      \
+        ::bench::details::trackedDelete(p);                                    \
+    }                                                                          \
+    void operator delete[](void* p, std::size_t) noexcept {                    \
+        ::bench::details::trackedDelete(p);                                    \
+    }
+
+} // namespace bench
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace bench {
+
+#ifndef ALGOLIA_PROFILING_ARENA_BLOCK
+    #define ALGOLIA_PROFILING_ARENA_BLOCK (1 << 20)
+#endif
+
+// -----
+// Arena
+// -----
+
+/**
+ * Bump allocator backing the bench nodes and their comments. Memory is taken
+ * from the system by blocks of ALGOLIA_PROFILING_ARENA_BLOCK bytes and is only
+ * given back when the arena dies, so recording a bench does not go through
+ * the heap once the current block is warm.
+ *
+ * The blocks can also be given away at once (`detach`) along with the
+ * objects they hold, and handed back through the recycle bin once those
+ * objects are destroyed, which is how the streaming flush bounds the memory
+ * of a thread (see `BenchEnv::startStreaming`).
+ *
+ * @Note not thread safe, there is one arena per thread and per infos type
+ *       (see `localArena`). Only `RecycleBin::recycle` can be called from
+ *       another thread.
+ */
+class Arena {
+public:
+    struct Block {
+        Block* next;
+        std::size_t size;
+    };
+
+    /**
+     * Blocks given back to an arena by another thread. Shared with the
+     * holders of detached blocks so that it outlives a dead arena.
+     */
+    class RecycleBin {
+    public:
+        ~RecycleBin() { freeBlocks(_blocks.exchange(nullptr)); }
+
+        // Lock-free, the owner takes every block at once
+        void recycle(Block* blocks) {
+            if (!blocks) {
+                return;
+            }
+            Block* last = blocks;
+            std::size_t size = last->size;
+            while (last->next) {
+                last = last->next;
+                size += last->size;
+            }
+            last->next = _blocks.load(std::memory_order_relaxed);
+            while (!_blocks.compare_exchange_weak(last->next, blocks,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed)) {}
+            _inFlight.fetch_sub(size, std::memory_order_relaxed);
+        }
+
+        Block* takeAll() { return _blocks.exchange(nullptr, std::memory_order_acquire); }
+
+        // Account for `blocks`, given away and not recycled yet
+        void handedOver(const Block* blocks) {
+            std::size_t size = 0;
+            for (; blocks; blocks = blocks->next) {
+                size += blocks->size;
+            }
+            _inFlight.fetch_add(size, std::memory_order_relaxed);
+        }
+
+        std::size_t inFlight() const { return _inFlight.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<Block*> _blocks = nullptr;
+        std::atomic<std::size_t> _inFlight = 0;
+    };
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        freeBlocks(_blocks);
+        freeBlocks(_free);
+    }
+
+    FORCEINLINE void* allocate(std::size_t size, std::size_t align) {
+        std::size_t pos = (_pos + align - 1) & ~(align - 1);
+        if (pos + size > _capacity) {
+            newBlock(size + align);
+            pos = (_pos + align - 1) & ~(align - 1);
+        }
+        _pos = pos + size;
+        return _data + pos;
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+    }
+
+    /**
+     * Give away every block in use. The objects they hold must be destroyed
+     * before the blocks are recycled (see `RecycleBin`).
+     */
+    Block* detach() {
+        Block* ret = _blocks;
+        _blocks = nullptr;
+        _data = nullptr;
+        _pos = _capacity = 0;
+        return ret;
+    }
+
+    /**
+     * Reuse `blocks`, detached from this arena, once the objects they hold
+     * are destroyed.
+     */
+    void reuse(Block* blocks) {
+        while (blocks) {
+            Block* next = blocks->next;
+            blocks->next = _free;
+            _free = blocks;
+            blocks = next;
+        }
+    }
+
+    const std::shared_ptr<RecycleBin>& recycleBin() {
+        if (!_bin) {
+            _bin = std::make_shared<RecycleBin>();
+        }
+        return _bin;
+    }
+
+    /**
+     * A bench object holding memory of the arena while not being in the tree
+     * yet pins the arena, so that its blocks are not detached meanwhile.
+     */
+    void pin() { ++_pins; }
+    void unpin() { --_pins; }
+    AULong pins() const { return _pins; }
+
+    // Memory taken from the system
+    std::size_t reserved() const { return _reserved; }
+
+private:
+    static void freeBlocks(Block* blocks) {
+        while (blocks) {
+            Block* next = blocks->next;
+            ::operator delete(blocks);
+            blocks = next;
+        }
+    }
+
+    // Take a recycled block big enough if any, a new one otherwise
+    void newBlock(std::size_t minSize) {
+        minSize += sizeof(Block);
+        if (_bin) {
+            Block* recycled = _bin->takeAll();
+            while (recycled) {
+                Block* next = recycled->next;
+                recycled->next = _free;
+                _free = recycled;
+                recycled = next;
+            }
+        }
+
+        Block* block = nullptr;
+        for (Block** it = &_free; *it; it = &(*it)->next) {
+            if ((*it)->size >= minSize) {
+                block = *it;
+                *it = block->next;
+                break;
+            }
+        }
+
+        if (!block) {
+            const std::size_t size = std::max<std::size_t>(ALGOLIA_PROFILING_ARENA_BLOCK, minSize);
+            block = static_cast<Block*>(::operator new(size));
+            block->size = size;
+            _reserved += size;
+        }
+
+        block->next = _blocks;
+        _blocks = block;
+
+        _data = reinterpret_cast<char*>(block);
+        _pos = sizeof(Block);
+        _capacity = block->size;
+    }
+
+    Block* _blocks = nullptr; // In use
+    Block* _free = nullptr; // Recycled
+    char* _data = nullptr;
+    std::size_t _pos = 0;
+    std::size_t _capacity = 0;
+    std::size_t _reserved = 0;
+    AULong _pins = 0;
+    std::shared_ptr<RecycleBin> _bin;
+};
+
+/**
+ * Arena of the calling thread for the trees of `Infos` and their comments. It
+ * is created before, and therefore destroyed after, the thread local
+ * environment using it.
+ *
+ * @Note each infos type has its own arena: the blocks of a streamed
+ *       environment are given away without the nodes of the other ones.
+ */
+template <typename Infos>
+static inline Arena& localArena() {
+    static thread_local Arena arena;
+    return arena;
+}
+
+/**
+ * Standard allocator over `localArena<Infos>`. Deallocation is a no-op: the
+ * memory is reclaimed with the arena.
+ *
+ * @Note the containers using it must be destroyed by the thread which filled
+ *       them, which is always the case for the bench infos.
+ */
+template <typename T, typename Infos>
+struct ArenaAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = ArenaAllocator<U, Infos>; };
+
+    ArenaAllocator() = default;
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U, Infos>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(localArena<Infos>().allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, std::size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U, Infos>&) const { return true; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U, Infos>&) const { return false; }
+};
+
+} // namespace bench
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "utils/bench/BenchTree.h"
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace bench {
+
+// -------------------
+// Binary dump format
+// -------------------
+
+/**
+ * Compact alternative to the JSON dump. Numbers are unsigned LEB128 varints,
+ * strings are a varint length followed by the bytes.
+ *
+ *  file    := magic("BENCHBIN") version thread*
+ *  thread  := threadId nbStrings string* nbNodes node*
+ *  node    := parent nameId flags elapsedNs nbComments (keyId valueId)*
+ *             nbMeasures (keyId kind value)*  (since version 2)
+ *             [count minNs maxNs meanNs stddevNs]  (if flags & aggregated)
+ *
+ * Nodes are written in pre-order. `parent` is the index of the parent node
+ * plus one, 0 meaning the node is at the top of the thread's tree. Names,
+ * comments and measure keys are indices in the string table of the thread.
+ *
+ * The measures are the other values of the JSON dump which are recorded: the
+ * corrected time, the hardware counters, the allocations, the CPU time and the
+ * metrics. `kind` tells how to read `value` (see `Measure`). The ratios derived
+ * from them (IPC, off CPU time, rates) are not stored.
+ */
+namespace binary {
+
+constexpr inline char magic[8] = { 'B', 'E', 'N', 'C', 'H', 'B', 'I', 'N' };
+constexpr inline AULong version = 2;
+
+enum Flags : AULong {
+    internal = 1 << 0,
+    aggregated = 1 << 1,
+};
+
+enum Measure : AULong {
+    nanoseconds = 0,
+    count = 1,
+    real = 2, // The bits of a double
+};
+
+static inline void putVarint(std::string& out, AULong v) {
+    while (v >= 0x80) {
+        out.push_back(char(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(char(v));
+}
+
+static inline void putString(std::string& out, std::string_view str) {
+    putVarint(out, str.size());
+    out.append(str.data(), str.size());
+}
+
+/**
+ * @return false if the buffer ends in the middle of the varint.
+ */
+static inline bool getVarint(const char*& it, const char* end, AULong& v) {
+    v = 0;
+    for (unsigned shift = 0; it != end && shift < 64; shift += 7) {
+        const uint8_t byte = *it++;
+        v |= AULong(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool getString(const char*& it, const char* end, std::string_view& str) {
+    AULong size;
+    if (!getVarint(it, end, size) || AULong(end - it) < size) {
+        return false;
+    }
+    str = std::string_view(it, size);
+    it += size;
+    return true;
+}
+
+} // namespace binary
+
+/**
+ * Write a tree in the binary format. The strings are interned into a table
+ * written before the nodes, the nodes are buffered meanwhile.
+ */
+template <class Infos>
+struct BinaryDumpVisitor : public Tree<Infos>::template Visitor<BinaryDumpVisitor<Infos>> {
+    using Node = typename Tree<Infos>::Node;
+    using InternalNode = typename Tree<Infos>::InternalNode;
+
+    /**
+     * @param calibration_ cost of the instrumentation subtracted from the
+     *        elapsed times to get the "corrected" ones (see BenchOverhead.h).
+     */
+    explicit BinaryDumpVisitor(const OverheadCalibration& calibration_ = {})
+        : calibration(calibration_) {}
+
+    void visit(const Node& n) {
+        dumpInfos(n.value, Inclusive::of(n.value), 0);
+    }
+
+    void visit(const InternalNode& n) {
+        const AULong index = dumpInfos(n.value, inclusive.next(n), binary::internal);
+
+        const AULong father = parent;
+        parent = index + 1;
+        n.children.foreach([&](auto&& child) {
+            child.accept(*this);
+        });
+        parent = father;
+    }
+
+    /**
+     * Append the string table and the nodes of the thread to `out`.
+     */
+    void flush(std::string& out, std::string_view threadId) {
+        binary::putString(out, threadId);
+        binary::putVarint(out, strings.size());
+        for (const auto& str : strings) {
+            binary::putString(out, str);
+        }
+        binary::putVarint(out, nbNodes);
+        out.append(nodes);
+    }
+
+private:
+    // `values` are the ones of the subtree, see `Inclusive`
+    template <typename Values>
+    AULong dumpInfos(const Infos& infos, const Values& values, AULong flags) {
+        if constexpr (is_aggregated_v<Infos>) {
+            flags |= binary::aggregated;
+        }
+
+        binary::putVarint(nodes, parent);
+        binary::putVarint(nodes, intern(infos.name));
+        binary::putVarint(nodes, flags);
+        binary::putVarint(nodes, values.elapsed.count());
+        binary::putVarint(nodes, infos.comments.size());
+        for (const auto& comment : infos.comments) {
+            binary::putVarint(nodes, intern(comment.key));
+            binary::putVarint(nodes, internOwned(commentToString(comment.value)));
+        }
+        dumpMeasures(infos, values);
+
+        if constexpr (is_aggregated_v<Infos>) {
+            binary::putVarint(nodes, infos.count);
+            binary::putVarint(nodes, infos.min.count());
+            binary::putVarint(nodes, infos.max.count());
+            binary::putVarint(nodes, AULong(infos.mean));
+            binary::putVarint(nodes, AULong(infos.stddev()));
+        }
+
+        return nbNodes++;
+    }
+
+    template <typename Values>
+    void dumpMeasures(const Infos& infos, const Values& values) {
+        measures.clear();
+        nbMeasures = 0;
+
+        if constexpr (std::is_same_v<Overhead_t, Overhead>) {
+            putMeasure("corrected", binary::nanoseconds,
+                       calibration.correct(values.elapsed, values.overhead).count());
+        }
+
+        if constexpr (std::is_same_v<Counters_t, HardwareCounters>) {
+            if (values.counters.available) {
+                putMeasure("cycles", binary::count, values.counters.cycles);
+                putMeasure("instructions", binary::count, values.counters.instructions);
+                putMeasure("l1d_misses", binary::count, values.counters.l1dMisses);
+                putMeasure("llc_misses", binary::count, values.counters.llcMisses);
+                putMeasure("branch_misses", binary::count, values.counters.branchMisses);
+            }
+        }
+
+        if constexpr (std::is_same_v<Allocations_t, Allocations>) {
+            putMeasure("allocations", binary::count, values.allocations.count);
+            putMeasure("allocated_bytes", binary::count, values.allocations.allocated);
+            putMeasure("freed_bytes", binary::count, values.allocations.freed);
+        }
+
+        if constexpr (std::is_same_v<CpuTime_t, CpuTime>) {
+            putMeasure("cpu_time", binary::nanoseconds, values.cpuTime.cpu.count());
+        }
+
+        for (const auto& metric : infos.metrics) {
+            std::visit([&](auto v) {
+                if constexpr (std::is_integral_v<decltype(v)>) {
+                    if (v >= 0) {
+                        putMeasure(metric.key, binary::count, AULong(v));
+                        return;
+                    }
+                }
+                const double real = double(v);
+                AULong bits;
+                memcpy(&bits, &real, sizeof(bits));
+                putMeasure(metric.key, binary::real, bits);
+            }, metric.value);
+        }
+
+        binary::putVarint(nodes, nbMeasures);
+        nodes.append(measures);
+    }
+
+    void putMeasure(const char* key, binary::Measure kind, AULong value) {
+        binary::putVarint(measures, intern(key));
+        binary::putVarint(measures, kind);
+        binary::putVarint(measures, value);
+        ++nbMeasures;
+    }
+
+    // The names and keys are literals, which outlive the visitor
+    AULong intern(std::string_view str) {
+        const auto [it, inserted] = stringIds.try_emplace(str, strings.size());
+        if (inserted) {
+            strings.push_back(str);
+        }
+        return it->second;
+    }
+
+    // The comment values are formatted on the fly, keep them alive
+    AULong internOwned(std::string&& str) {
+        const auto it = stringIds.find(str);
+        if (it != stringIds.end()) {
+            return it->second;
+        }
+        return intern(std::string_view(formatted.emplace_back(std::move(str))));
+    }
+
+    std::unordered_map<std::string_view, AULong> stringIds;
+    std::vector<std::string_view> strings;
+    std::deque<std::string> formatted;
+    std::string nodes;
+    std::string measures; // Of the node being written
+    AULong nbNodes = 0;
+    AULong nbMeasures = 0;
+    AULong parent = 0;
+    OverheadCalibration calibration;
+    InclusiveValues<Infos> inclusive;
+};
+
+} // namespace bench
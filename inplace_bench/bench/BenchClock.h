@@ -0,0 +1,177 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <cpuid.h>
+    #include <x86intrin.h>
+    #define BENCH_HAS_TSC 1
+#else
+    #define BENCH_HAS_TSC 0
+#endif
+
+namespace bench {
+
+// -------------
+// Clock sources
+// -------------
+
+/**
+ * A clock policy gives the `start` and `stop` ticks of a measure and converts
+ * the difference between two ticks into nanoseconds:
+ *
+ *      struct Clock {
+ *          using tick_t = ...;
+ *          static tick_t start();
+ *          static tick_t stop();
+ *          static std::chrono::nanoseconds elapsed(tick_t start, tick_t stop);
+ *          // Nanoseconds on the timeline of std::chrono::steady_clock, so
+ *          // that the timestamps of every thread and every clock line up
+ *          static AULong timestamp(tick_t tick);
+ *      };
+ */
+struct SteadyClock {
+    using tick_t = std::chrono::steady_clock::time_point;
+
+    static FORCEINLINE tick_t start() { return std::chrono::steady_clock::now(); }
+    static FORCEINLINE tick_t stop() { return std::chrono::steady_clock::now(); }
+
+    static FORCEINLINE std::chrono::nanoseconds elapsed(tick_t start, tick_t stop) {
+        return stop - start;
+    }
+
+    static FORCEINLINE AULong timestamp(tick_t tick) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            tick.time_since_epoch()).count();
+    }
+};
+
+#ifndef ALGOLIA_PROFILING_TSC
+    #define ALGOLIA_PROFILING_TSC BENCH_HAS_TSC
+#endif
+
+#if ALGOLIA_PROFILING == 1 && ALGOLIA_PROFILING_TSC == 1
+/**
+ * Conversion factor between TSC ticks and nanoseconds, measured once against
+ * `std::chrono::steady_clock`.
+ */
+struct TscCalibration {
+    bool usable = false;
+    // Nanoseconds per tick as a 32.32 fixed point number
+    AULong nsPerTick = 0;
+    // steady_clock nanoseconds minus the converted ticks, see `TscClock::timestamp`
+    ALong offset = 0;
+
+    static TscCalibration calibrate() {
+        TscCalibration ret;
+#if BENCH_HAS_TSC
+        unsigned eax, ebx, ecx, edx;
+        // Invariant TSC: constant rate in every P/C/T-state
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+            return ret;
+        }
+
+        const auto t0 = std::chrono::steady_clock::now();
+        const AULong c0 = __rdtsc();
+        auto t1 = t0;
+        while (t1 - t0 < std::chrono::milliseconds(10)) {
+            t1 = std::chrono::steady_clock::now();
+        }
+        const AULong c1 = __rdtsc();
+
+        const auto ns = std::chrono::nanoseconds(t1 - t0).count();
+        if (c1 > c0 && ns > 0) {
+            ret.nsPerTick = (static_cast<unsigned __int128>(ns) << 32) / (c1 - c0);
+            ret.usable = ret.nsPerTick > 0;
+            ret.offset = ALong(SteadyClock::timestamp(t1))
+                       - ALong((static_cast<unsigned __int128>(c1) * ret.nsPerTick) >> 32);
+        }
+#endif
+        return ret;
+    }
+};
+
+/**
+ * Calibrate on the first call, that is by the first `TscClock::start` of the
+ * process: a tick is never converted before the calibration is known.
+ *
+ * @Note the first bench object started, or the first dump when none was (see
+ *       `overheadCalibration`), waits for the calibration (about 10ms). The
+ *       programs which neither record nor dump anything do not.
+ */
+static FORCEINLINE const TscCalibration& tscCalibration() {
+    static const TscCalibration calibration = TscCalibration::calibrate();
+    return calibration;
+}
+
+/**
+ * Read the timestamp counter of the CPU instead of going through the vDSO.
+ * `start` is not reordered with the following instructions and `stop` waits
+ * for the previous ones to complete.
+ *
+ * Falls back on `std::chrono::steady_clock` when the CPU has no invariant TSC.
+ */
+struct TscClock {
+    using tick_t = AULong;
+
+    static FORCEINLINE tick_t start() {
+#if BENCH_HAS_TSC
+        if (__builtin_expect(tscCalibration().usable, 1)) {
+            const tick_t t = __rdtsc();
+            _mm_lfence();
+            return t;
+        }
+#endif
+        return steadyNow();
+    }
+
+    static FORCEINLINE tick_t stop() {
+#if BENCH_HAS_TSC
+        if (__builtin_expect(tscCalibration().usable, 1)) {
+            unsigned aux;
+            return __rdtscp(&aux);
+        }
+#endif
+        return steadyNow();
+    }
+
+    static FORCEINLINE std::chrono::nanoseconds elapsed(tick_t start, tick_t stop) {
+        const TscCalibration& calibration = tscCalibration();
+        if (__builtin_expect(calibration.usable, 1)) {
+            const auto ticks = static_cast<unsigned __int128>(stop - start);
+            return std::chrono::nanoseconds((ticks * calibration.nsPerTick) >> 32);
+        }
+        return std::chrono::nanoseconds(stop - start);
+    }
+
+    static FORCEINLINE AULong timestamp(tick_t tick) {
+        const TscCalibration& calibration = tscCalibration();
+        if (__builtin_expect(calibration.usable, 1)) {
+            const AULong ns = (static_cast<unsigned __int128>(tick) * calibration.nsPerTick) >> 32;
+            return ns + AULong(calibration.offset);
+        }
+        return tick;
+    }
+
+private:
+    static tick_t steadyNow() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+#endif
+
+/**
+ * Clock used by default by the bench objects. Define ALGOLIA_PROFILING_TSC to 0
+ * to always use steady_clock, `TscClock` is then not compiled at all.
+ */
+#if ALGOLIA_PROFILING == 1 && ALGOLIA_PROFILING_TSC == 1
+using DefaultBenchClock = TscClock;
+#else
+using DefaultBenchClock = SteadyClock;
+#endif
+
+} // namespace bench
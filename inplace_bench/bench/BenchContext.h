@@ -0,0 +1,500 @@
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+    #include <coroutine>
+    #define BENCH_HAS_COROUTINES 1
+#else
+    #define BENCH_HAS_COROUTINES 0
+#endif
+
+#include "utils/bench/BenchUtils.h"
+#include "utils/bench/BenchAllocations.h"
+#include "utils/bench/BenchCpuTime.h"
+#include "utils/bench/BenchInfos.h"
+#include "utils/bench/BenchOverhead.h"
+
+namespace bench {
+
+template <typename Infos>
+class BenchEnv;
+
+template <typename Infos>
+static BenchEnv<Infos>& getEnvInstance();
+
+// -------------
+// Task contexts
+// -------------
+#if ALGOLIA_PROFILING == 1
+/**
+ * Logical tree of a task whose code runs on several threads, or interleaves
+ * with other tasks on a thread: coroutines, callbacks of an event loop, ...
+ * While the context is attached to a thread, the bench objects of the thread
+ * go into the context instead of the thread's tree. The context is detached
+ * when the task suspends and attached again, maybe on another thread, when it
+ * resumes: each such segment is recorded with the thread running it.
+ *
+ * When the context is destroyed (or `finish` is called), its tree is added to
+ * the tree of the calling thread under a bunch named after the task, each
+ * node holding a "thread" comment. The context attached to that thread, if
+ * any, receives it instead: a sub-task is then part of its parent.
+ *
+ * The benches of a task also count the nested benches, the allocations and
+ * the CPU time of the task rather than the ones of the thread, so that a
+ * `BenchScope` can span a suspension.
+ *
+ * @Example ```
+ *      bench::BenchContext context("request");
+ *      pool.post([&] {
+ *          bench::BenchContext<>::Attached attached(context);
+ *          bench::BenchScope scope("parse");
+ *      });
+ *          ```
+ *
+ * @Note the nodes are kept on the heap until the task finishes, the arena of
+ *       a thread being bound to it.
+ * @Note a bunch of the task must end before it finishes, and the hardware
+ *       counters of a scope spanning a suspension are not meaningful.
+ * @Note a bench object of a thread wrapping the resumption of a task does not
+ *       count the benches nor the allocations of the task.
+ */
+template <typename Infos = DefaultBenchInfos>
+class BenchContext {
+public:
+    template <std::size_t N>
+    explicit BenchContext(const char (&name)[N]) : _name(name) {}
+
+    ~BenchContext() {
+        if (_attached) {
+            detach();
+        }
+        finish();
+    }
+
+    BenchContext(const BenchContext&) = delete;
+    BenchContext(BenchContext&&) = delete;
+    BenchContext& operator=(const BenchContext&) = delete;
+    BenchContext& operator=(BenchContext&&) = delete;
+
+    /**
+     * Attach the context to the calling thread, when the task starts or
+     * resumes on it. Contexts attached to the same thread are stacked.
+     */
+    void attach() {
+        assert(!_attached);
+        _attached = true;
+        _previous = _current;
+        _current = this;
+        _segments.push_back(std::this_thread::get_id());
+
+        // The benches of the task read its counters
+        std::swap(nbRecordedBenches, _recorded);
+        std::swap(recordedTime, _recordedTime);
+        std::swap(threadAllocations, _allocations);
+        if constexpr (std::is_same_v<CpuTime_t, CpuTime>) {
+            _threadCpuTimeOffset = cpuTimeOffset;
+            cpuTimeOffset = _cpuTime - threadCpuTime();
+        }
+
+        // The bench objects spanning the suspension move to this arena
+        for (Held& held : _held) {
+            localArena<Infos>().pin();
+            restore(*held.infos, held.comments, held.metrics);
+            held.comments.clear();
+            held.metrics.clear();
+        }
+    }
+
+    /**
+     * Detach the context from the calling thread, when the task suspends or
+     * ends. The context must be the last one attached to the thread.
+     */
+    void detach() {
+        assert(_attached && _current == this);
+        if constexpr (std::is_same_v<CpuTime_t, CpuTime>) {
+            _cpuTime = threadCpuTime() + cpuTimeOffset;
+            cpuTimeOffset = _threadCpuTimeOffset;
+        }
+        std::swap(threadAllocations, _allocations);
+        std::swap(recordedTime, _recordedTime);
+        std::swap(nbRecordedBenches, _recorded);
+
+        // The bunches still open may get comments on another thread
+        for (const AUInt i : _open) {
+            evacuate(_nodes[i]);
+        }
+        for (Held& held : _held) {
+            evacuate(*held.infos, held.comments, held.metrics);
+            localArena<Infos>().unpin();
+        }
+        _current = _previous;
+        _attached = false;
+    }
+
+    /**
+     * Add the tree of the task to the one of the calling thread, see the class
+     * notes. Only done once, the context must be detached.
+     */
+    void finish();
+
+    // Context attached to the calling thread, if any
+    static BenchContext* current() { return _current; }
+
+    /**
+     * Attach a context for the lifetime of this object.
+     */
+    struct Attached {
+        explicit Attached(BenchContext& context_) : context(context_) { context.attach(); }
+        ~Attached() { context.detach(); }
+
+        Attached(const Attached&) = delete;
+        Attached& operator=(const Attached&) = delete;
+
+        BenchContext& context;
+    };
+
+    // -----------------------------------------------------------------
+    // Same as the ones of `BenchEnv`, which forwards to the current context
+    // -----------------------------------------------------------------
+    Infos& addLeaf(Infos&& infos) {
+        Node& node = append(std::move(infos), false);
+        evacuate(node);
+        return node.infos;
+    }
+
+    Infos& addSubLevel(Infos&& infos) {
+        Node& node = append(std::move(infos), true);
+        _open.push_back(AUInt(_nodes.size() - 1));
+        return node.infos;
+    }
+
+    void endSubLevel() {
+        assert(!_open.empty());
+        evacuate(_nodes[_open.back()]);
+        _open.pop_back();
+    }
+
+    // -----------------------------------------------------------------
+    // See `ArenaPin`
+    // -----------------------------------------------------------------
+    void hold(Infos& infos) { _held.push_back(Held{ &infos, {}, {} }); }
+
+    void rebind(const Infos& from, Infos& to) { find(from).infos = &to; }
+
+    void release(const Infos& infos) {
+        _held.erase(_held.begin() + (&find(infos) - _held.data()));
+    }
+
+private:
+    static constexpr AUInt npos = ~AUInt(0);
+
+    using Comment_t = typename Infos::Comment_t;
+
+    struct Node {
+        Infos infos; // Without its comments and metrics once evacuated
+        AUInt parent;
+        AUInt segment;
+        bool internal;
+        std::vector<Comment_t> comments;
+        std::vector<Metric> metrics;
+    };
+
+    // Bench object not ended yet, holding comments or metrics
+    struct Held {
+        Infos* infos;
+        std::vector<Comment_t> comments; // While detached
+        std::vector<Metric> metrics;
+    };
+
+    Held& find(const Infos& infos) {
+        auto it = std::find_if(_held.rbegin(), _held.rend(),
+                               [&](const Held& held) { return held.infos == &infos; });
+        assert(it != _held.rend());
+        return *it;
+    }
+
+    Node& append(Infos&& infos, bool internal) {
+        const AUInt parent = _open.empty() ? npos : _open.back();
+        _nodes.push_back(Node{ std::move(infos), parent, AUInt(_segments.size() - 1), internal, {}, {} });
+        return _nodes.back();
+    }
+
+    /**
+     * Move the comments and the metrics of `node` out of the arena of the
+     * calling thread, which is bound to it.
+     */
+    static void evacuate(Node& node) { evacuate(node.infos, node.comments, node.metrics); }
+
+    static void evacuate(Infos& infos, std::vector<Comment_t>& comments,
+                         std::vector<Metric>& metrics) {
+        for (auto& comment : infos.comments) {
+            comments.push_back(std::move(comment));
+        }
+        typename Infos::Comments_t().swap(infos.comments);
+        metrics.insert(metrics.end(), infos.metrics.begin(), infos.metrics.end());
+        typename Infos::Metrics_t().swap(infos.metrics);
+    }
+
+    // Back into the arena of the calling thread
+    static void restore(Infos& infos, std::vector<Comment_t>& comments,
+                        const std::vector<Metric>& metrics) {
+        for (auto& comment : comments) {
+            infos.comments.push_back(std::move(comment));
+        }
+        for (const auto& metric : metrics) {
+            std::visit([&](auto v) { addMetric(infos.metrics, metric.key, v); }, metric.value);
+        }
+    }
+
+    static inline thread_local BenchContext* _current = nullptr;
+
+    const char* _name;
+    std::deque<Node> _nodes; // In pre-order, the references stay valid
+    std::vector<AUInt> _open; // Bunches not ended yet
+    std::vector<Held> _held; // Scopes and tasks not ended yet, see `ArenaPin`
+    std::vector<std::thread::id> _segments; // Thread of each segment
+    bool _attached = false;
+    bool _finished = false;
+    BenchContext* _previous = nullptr;
+
+    // Counters of the task while detached, of the thread while attached
+    AULong _recorded = 0;
+    std::chrono::nanoseconds _recordedTime{};
+    Allocations _allocations;
+    std::chrono::nanoseconds _cpuTime{};
+    std::chrono::nanoseconds _threadCpuTimeOffset{};
+};
+
+template <typename Infos>
+void BenchContext<Infos>::finish() {
+    assert(!_attached && _held.empty());
+    if (_finished) {
+        return;
+    }
+    _finished = true;
+
+    static constexpr const char threadKey[] = "thread";
+    std::vector<std::string> threads;
+    threads.reserve(_segments.size());
+    for (const auto& tid : _segments) {
+        threads.push_back(threadIdToStr(tid));
+    }
+
+    auto& env = getEnvInstance<Infos>();
+    Infos task(_name);
+    task.addComment("segments", _segments.size());
+    env.addSubLevel(std::move(task));
+
+    std::vector<AUInt> open;
+    for (AUInt i = 0; i < _nodes.size(); ++i) {
+        Node& node = _nodes[i];
+        for (; !open.empty() && open.back() != node.parent; open.pop_back()) {
+            env.endSubLevel();
+        }
+
+        evacuate(node);
+        Infos& infos = node.infos;
+        restore(infos, node.comments, node.metrics);
+        infos.comments.push_back({ threadKey, threads[node.segment] });
+
+        if (node.internal) {
+            env.addSubLevel(std::move(infos));
+            open.push_back(i);
+        } else {
+            env.addLeaf(std::move(infos));
+        }
+    }
+    for (; !open.empty(); open.pop_back()) {
+        env.endSubLevel();
+    }
+    env.endSubLevel();
+
+    _nodes.clear();
+    _segments.clear();
+}
+
+/**
+ * Pin of the arena by a bench object holding comments or metrics (see
+ * `Arena::pin`). The object may belong to a task which suspends and resumes
+ * on another thread: the context then moves the comments and the metrics out
+ * of the arena when it detaches, and hands the pin over to the arena of the
+ * thread it is attached to next. The object always unpins the arena of the
+ * thread it ends on.
+ */
+template <typename Infos>
+class ArenaPin {
+public:
+    ArenaPin() = default;
+    ArenaPin(const ArenaPin&) = delete;
+    ArenaPin& operator=(const ArenaPin&) = delete;
+
+    // `moved` has to be called with the infos of both objects
+    ArenaPin(ArenaPin&& o) : _context(o._context), _pinned(o._pinned) { o._pinned = false; }
+
+    FORCEINLINE void pin(Infos& infos) {
+        if (!_pinned) {
+            _pinned = true;
+            localArena<Infos>().pin();
+            _context = BenchContext<Infos>::current();
+            if (_context) {
+                _context->hold(infos);
+            }
+        }
+    }
+
+    // After the infos are added to the tree
+    FORCEINLINE void unpin(const Infos& infos) {
+        if (_pinned) {
+            _pinned = false;
+            if (_context) {
+                _context->release(infos);
+            }
+            localArena<Infos>().unpin();
+        }
+    }
+
+    void moved(const Infos& from, Infos& to) {
+        if (_pinned && _context) {
+            _context->rebind(from, to);
+        }
+    }
+
+private:
+    BenchContext<Infos>* _context = nullptr;
+    bool _pinned = false;
+};
+
+#if BENCH_HAS_COROUTINES
+/**
+ * Awaiter detaching the context of a coroutine when it suspends on
+ * `awaiter`, and attaching it back when it resumes, whichever the thread.
+ */
+template <typename Awaiter, typename Infos>
+struct ContextAwaiter {
+    Awaiter awaiter; // A reference when the awaitable was an lvalue
+    BenchContext<Infos>& context;
+
+    bool await_ready() { return awaiter.await_ready(); }
+
+    // The coroutine may be resumed before `await_suspend` of `awaiter` returns
+    template <typename Promise>
+    decltype(auto) await_suspend(std::coroutine_handle<Promise> handle) {
+        context.detach();
+        return awaiter.await_suspend(handle);
+    }
+
+    decltype(auto) await_resume() {
+        context.attach();
+        return awaiter.await_resume();
+    }
+};
+
+namespace details {
+    template <typename Awaitable>
+    decltype(auto) getAwaiter(Awaitable&& awaitable) {
+        if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); }) {
+            return std::forward<Awaitable>(awaitable).operator co_await();
+        } else if constexpr (requires { operator co_await(std::forward<Awaitable>(awaitable)); }) {
+            return operator co_await(std::forward<Awaitable>(awaitable));
+        } else {
+            return std::forward<Awaitable>(awaitable);
+        }
+    }
+} // namespace details
+
+/**
+ * Base of a coroutine promise carrying a `BenchContext`: the coroutine gets a
+ * logical tree of its own, attached to the thread running it between its
+ * suspension points. It starts suspended and the tree is added to the thread
+ * destroying the coroutine (see `BenchContext::finish`).
+ *
+ * @Example ```
+ *      struct Task {
+ *          struct promise_type : bench::BenchPromise<> {
+ *              promise_type() : BenchPromise("fetch") {}
+ *              // get_return_object, return_void, unhandled_exception
+ *          };
+ *      };
+ *          ```
+ *
+ * @Note a promise defining `await_transform`, `initial_suspend` or
+ *       `final_suspend` itself has to do the same.
+ */
+template <typename Infos = DefaultBenchInfos>
+struct BenchPromise {
+    BenchPromise() : benchContext("coroutine") {}
+
+    template <std::size_t N>
+    explicit BenchPromise(const char (&name)[N]) : benchContext(name) {}
+
+    template <typename Awaitable>
+    auto await_transform(Awaitable&& awaitable) {
+        using Awaiter = decltype(details::getAwaiter(std::forward<Awaitable>(awaitable)));
+        return ContextAwaiter<Awaiter, Infos>{
+            details::getAwaiter(std::forward<Awaitable>(awaitable)), benchContext };
+    }
+
+    // Attach the context on the first resumption
+    auto initial_suspend() noexcept {
+        struct Start : std::suspend_always {
+            BenchContext<Infos>& context;
+            void await_resume() noexcept { context.attach(); }
+        };
+        return Start{ {}, benchContext };
+    }
+
+    auto final_suspend() noexcept {
+        struct Final : std::suspend_always {
+            BenchContext<Infos>& context;
+            void await_suspend(std::coroutine_handle<>) noexcept { context.detach(); }
+        };
+        return Final{ {}, benchContext };
+    }
+
+    BenchContext<Infos> benchContext;
+};
+#endif
+
+#else
+template <typename Infos = DefaultBenchInfos>
+class BenchContext {
+public:
+    template <std::size_t N>
+    explicit BenchContext(const char (&)[N]) {}
+
+    BenchContext(const BenchContext&) = delete;
+    BenchContext& operator=(const BenchContext&) = delete;
+
+    void attach() {}
+    void detach() {}
+    void finish() {}
+    static BenchContext* current() { return nullptr; }
+
+    struct Attached {
+        explicit Attached(BenchContext&) {}
+    };
+};
+
+#if BENCH_HAS_COROUTINES
+template <typename Infos = DefaultBenchInfos>
+struct BenchPromise {
+    BenchPromise() = default;
+
+    template <std::size_t N>
+    explicit BenchPromise(const char (&)[N]) {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+};
+#endif
+#endif
+
+} // namespace bench
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <cstdint>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace bench {
+
+#ifndef ALGOLIA_PROFILING_COUNTERS
+    #define ALGOLIA_PROFILING_COUNTERS 0
+#endif
+
+// -----------------
+// Hardware counters
+// -----------------
+
+/**
+ * Values of the hardware counters read through `perf_event_open`.
+ * `available` is false when the counters could not be read (no PMU in a
+ * container, perf_event_paranoid too high, ...), only the time is then
+ * reported.
+ */
+struct HardwareCounters {
+    AULong cycles = 0;
+    AULong instructions = 0;
+    AULong l1dMisses = 0;
+    AULong llcMisses = 0;
+    AULong branchMisses = 0;
+    bool available = false;
+
+    HardwareCounters& operator+=(const HardwareCounters& o) {
+        cycles += o.cycles;
+        instructions += o.instructions;
+        l1dMisses += o.l1dMisses;
+        llcMisses += o.llcMisses;
+        branchMisses += o.branchMisses;
+        available |= o.available;
+        return *this;
+    }
+
+    HardwareCounters& operator*=(AULong factor) {
+        cycles *= factor;
+        instructions *= factor;
+        l1dMisses *= factor;
+        llcMisses *= factor;
+        branchMisses *= factor;
+        return *this;
+    }
+
+    HardwareCounters operator-(const HardwareCounters& o) const {
+        HardwareCounters ret;
+        ret.cycles = cycles - o.cycles;
+        ret.instructions = instructions - o.instructions;
+        ret.l1dMisses = l1dMisses - o.l1dMisses;
+        ret.llcMisses = llcMisses - o.llcMisses;
+        ret.branchMisses = branchMisses - o.branchMisses;
+        ret.available = available && o.available;
+        return ret;
+    }
+
+    double ipc() const { return cycles ? double(instructions) / cycles : 0.; }
+};
+
+/**
+ * Placeholder used instead of `HardwareCounters` when ALGOLIA_PROFILING_COUNTERS
+ * is disabled, so that the infos do not grow.
+ */
+struct NoCounters {
+    NoCounters& operator+=(const NoCounters&) { return *this; }
+    NoCounters& operator*=(AULong) { return *this; }
+    NoCounters operator-(const NoCounters&) const { return {}; }
+};
+
+#if ALGOLIA_PROFILING_COUNTERS == 1
+using Counters_t = HardwareCounters;
+#else
+using Counters_t = NoCounters;
+#endif
+
+/**
+ * Group of hardware counters of the calling thread. The group is opened on
+ * first use and read with a single `read` syscall.
+ *
+ * @Note cycles is the leader of the group, if it cannot be opened nothing is
+ *       counted. The other events are optional: an event missing on the
+ *       machine stays at 0.
+ */
+class PerfCounters {
+public:
+    static PerfCounters& getInstance() {
+        static thread_local PerfCounters counters;
+        return counters;
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters(PerfCounters&&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    PerfCounters& operator=(PerfCounters&&) = delete;
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (unsigned i = 0; i < _nbOpened; ++i) {
+            close(_fds[i]);
+        }
+#endif
+    }
+
+    /**
+     * @return the current value of the counters, with `available` set to
+     *         false if they cannot be read.
+     */
+    FORCEINLINE HardwareCounters read() const {
+        HardwareCounters ret;
+#if defined(__linux__)
+        if (_nbOpened == 0) {
+            return ret;
+        }
+
+        struct {
+            uint64_t nr;
+            uint64_t values[nbEvents];
+        } data;
+
+        if (::read(_fds[0], &data, sizeof(data)) <= 0) {
+            return ret;
+        }
+
+        for (uint64_t i = 0; i < data.nr && i < _nbOpened; ++i) {
+            ret.*(_fields[i]) = data.values[i];
+        }
+        ret.available = true;
+#endif
+        return ret;
+    }
+
+    bool available() const { return _nbOpened > 0; }
+
+private:
+    static constexpr unsigned nbEvents = 5;
+
+    PerfCounters() {
+#if defined(__linux__)
+        struct Event {
+            uint32_t type;
+            uint64_t config;
+            AULong HardwareCounters::* field;
+        };
+        static constexpr Event events[nbEvents] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, &HardwareCounters::cycles },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, &HardwareCounters::instructions },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+              &HardwareCounters::l1dMisses },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, &HardwareCounters::llcMisses },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, &HardwareCounters::branchMisses },
+        };
+
+        for (const auto& event : events) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = event.type;
+            attr.config = event.config;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = _nbOpened == 0; // The leader starts the whole group
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            const int groupFd = _nbOpened == 0 ? -1 : _fds[0];
+            const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+            if (fd < 0) {
+                if (_nbOpened == 0) {
+                    return; // No leader, no counters
+                }
+                continue;
+            }
+
+            _fds[_nbOpened] = fd;
+            _fields[_nbOpened] = event.field;
+            ++_nbOpened;
+        }
+
+        ioctl(_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    int _fds[nbEvents] = {};
+    AULong HardwareCounters::* _fields[nbEvents] = {};
+    unsigned _nbOpened = 0;
+};
+
+/**
+ * Read the counters of the calling thread when ALGOLIA_PROFILING_COUNTERS is
+ * enabled, do nothing otherwise.
+ */
+static FORCEINLINE Counters_t readCounters() {
+#if ALGOLIA_PROFILING_COUNTERS == 1
+    return PerfCounters::getInstance().read();
+#else
+    return {};
+#endif
+}
+
+/**
+ * Add to `acc` the counters delta between its creation and its destruction.
+ * Same as `ScopedTimer` for the hardware counters.
+ */
+struct ScopedCounters {
+    explicit ScopedCounters(Counters_t& acc_)
+        : acc(acc_), start(readCounters()) {}
+
+    FORCEINLINE ~ScopedCounters() {
+        acc += readCounters() - start;
+    }
+
+    ScopedCounters(const ScopedCounters&) = delete;
+    ScopedCounters(ScopedCounters&&) = delete;
+    ScopedCounters& operator=(const ScopedCounters&) = delete;
+    ScopedCounters& operator=(ScopedCounters&&) = delete;
+
+    Counters_t& acc;
+    const Counters_t start;
+};
+
+} // namespace bench
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <time.h>
+
+#include <chrono>
+
+namespace bench {
+
+#ifndef ALGOLIA_PROFILING_CPU_TIME
+    #define ALGOLIA_PROFILING_CPU_TIME 0
+#endif
+
+// ---------------
+// Thread CPU time
+// ---------------
+
+/**
+ * CPU time consumed by the calling thread, read from
+ * `CLOCK_THREAD_CPUTIME_ID`. Unlike the wall clock of the bench objects, this
+ * clock goes through a system call (see `BM_ThreadCpuTime`).
+ */
+static inline std::chrono::nanoseconds threadCpuTime() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+/**
+ * Time a bench spent running on a CPU. Its elapsed time minus this one is the
+ * time it spent off CPU: blocked on I/O or on a lock, or preempted.
+ */
+struct CpuTime {
+    std::chrono::nanoseconds cpu{};
+
+    CpuTime& operator+=(const CpuTime& o) {
+        cpu += o.cpu;
+        return *this;
+    }
+
+    CpuTime& operator*=(AULong factor) {
+        cpu *= ALong(factor);
+        return *this;
+    }
+
+    CpuTime operator-(const CpuTime& o) const {
+        return { cpu - o.cpu };
+    }
+};
+
+/**
+ * Placeholder used instead of `CpuTime` when ALGOLIA_PROFILING_CPU_TIME is
+ * disabled, so that the infos do not grow.
+ */
+struct NoCpuTime {
+    NoCpuTime& operator+=(const NoCpuTime&) { return *this; }
+    NoCpuTime& operator*=(AULong) { return *this; }
+    NoCpuTime operator-(const NoCpuTime&) const { return {}; }
+};
+
+#if ALGOLIA_PROFILING_CPU_TIME == 1
+using CpuTime_t = CpuTime;
+#else
+using CpuTime_t = NoCpuTime;
+#endif
+
+// Added to the CPU time read by the bench objects while a task is attached to
+// the thread, so that its benches read the CPU time of the task (see
+// `BenchContext`)
+inline thread_local std::chrono::nanoseconds cpuTimeOffset{};
+
+/**
+ * Read the CPU time of the calling thread when ALGOLIA_PROFILING_CPU_TIME is
+ * enabled, do nothing otherwise.
+ */
+static FORCEINLINE CpuTime_t readCpuTime() {
+#if ALGOLIA_PROFILING_CPU_TIME == 1
+    return { threadCpuTime() + cpuTimeOffset };
+#else
+    return {};
+#endif
+}
+
+/**
+ * Add to `acc` the CPU time consumed between its creation and its
+ * destruction. Same as `ScopedCounters` for the CPU time.
+ */
+struct ScopedCpuTime {
+    explicit ScopedCpuTime(CpuTime_t& acc_)
+        : acc(acc_), start(readCpuTime()) {}
+
+    FORCEINLINE ~ScopedCpuTime() {
+        acc += readCpuTime() - start;
+    }
+
+    ScopedCpuTime(const ScopedCpuTime&) = delete;
+    ScopedCpuTime(ScopedCpuTime&&) = delete;
+    ScopedCpuTime& operator=(const ScopedCpuTime&) = delete;
+    ScopedCpuTime& operator=(ScopedCpuTime&&) = delete;
+
+    CpuTime_t& acc;
+    const CpuTime_t start;
+};
+
+} // namespace bench
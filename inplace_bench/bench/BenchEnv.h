@@ -2,27 +2,148 @@
 
 #include "utils/bench/BenchUtils.h"
 #include "utils/bench/BenchTree.h"
+#include "utils/bench/BenchBinary.h"
+#include "utils/bench/BenchClock.h"
+#include "utils/bench/BenchContext.h"
+#include "utils/bench/BenchFolded.h"
 #include "utils/bench/BenchInfos.h"
+#include "utils/bench/BenchLock.h"
+#include "utils/bench/BenchMerge.h"
+#include "utils/bench/BenchOverhead.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
-#include <unordered_map>
 #include <thread>
 #include <sstream>
 #include <memory>
 #include <mutex>
+#include <algorithm>
 #include <utility>
 #include <vector>
 
 namespace bench {
+
+// Number of complete subtrees a thread keeps before handing them to the
+// streaming thread (see `BenchEnv::startStreaming`)
+#ifndef ALGOLIA_PROFILING_STREAM_BATCH
+    #define ALGOLIA_PROFILING_STREAM_BATCH 4096
+#endif
+
+// Memory of a thread waiting to be written by the streaming thread, above
+// which the subtrees are dropped
+#ifndef ALGOLIA_PROFILING_STREAM_MAX_BYTES
+    #define ALGOLIA_PROFILING_STREAM_MAX_BYTES (64 << 20)
+#endif
    
 template <typename Infos>
 class BenchEnv;
 
+enum class DumpFormat {
+    json,
+    binary, // See BenchBinary.h
+    merged, // See `BenchEnv::flushMerged`
+    folded, // See `BenchEnv::flushFolded`
+    foldedPerThread,
+};
+
 template <typename Infos>
 static BenchEnv<Infos>& getEnvInstance();
 
+// ---------------------------
+// Instrumentation calibration
+// ---------------------------
+#if ALGOLIA_PROFILING == 1 && ALGOLIA_PROFILING_CORRECTION == 1
+/**
+ * Measure the cost of the instrumentation by replaying what an empty
+ * `BenchScope` does (counters and clock reads, insertion into a tree) into a
+ * tree of its own, so that nothing is recorded. Both costs are the median of
+ * `rounds` measures, a nested cost being measured over `nested` benches.
+ *
+ * @Note the lookup of the thread local environment is not replayed, and the
+ *       nested cost of a `BenchBunch` is assumed to be the one of a scope.
+ */
+template <typename Clock, typename Infos>
+static OverheadCalibration calibrateOverhead(std::size_t rounds = 101,
+                                             std::size_t nested = 16) {
+    const AULong recorded = nbRecordedBenches;
+    const std::chrono::nanoseconds recordedTimeBefore = recordedTime;
+    Tree<Infos> tree;
+
+    auto emptyBench = [&tree] {
+        Infos infos("calibration");
+        const AULong recordedAtStart = nbRecordedBenches;
+        const std::chrono::nanoseconds recordedTimeAtStart = recordedTime;
+        const auto startCounters = readCounters();
+        const auto startAllocations = readAllocations();
+        const auto startCpuTime = readCpuTime();
+        const auto start = Clock::start();
+        infos.elapsed += Clock::elapsed(start, Clock::stop());
+        infos.counters += readCounters() - startCounters;
+        infos.allocations += readAllocations() - startAllocations;
+        infos.cpuTime += readCpuTime() - startCpuTime;
+        countMeasure(infos.overhead, recordedAtStart);
+        countNestedTime(infos.overhead, recordedTimeAtStart, infos.elapsed);
+        const auto elapsed = infos.elapsed;
+
+        countRecorded();
+        if constexpr (is_aggregated_v<Infos>) {
+            tree.mergeLeaf(std::move(infos));
+        } else {
+            tree.addLeaf(std::move(infos));
+        }
+        return elapsed.count();
+    };
+
+    std::vector<double> timers;
+    std::vector<double> enclosing;
+    for (std::size_t i = 0; i < rounds; ++i) {
+        timers.push_back(emptyBench());
+
+        const auto start = Clock::start();
+        for (std::size_t j = 0; j < nested; ++j) {
+            emptyBench();
+        }
+        enclosing.push_back(Clock::elapsed(start, Clock::stop()).count());
+    }
+
+    auto median = [](std::vector<double>& v) {
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return v[v.size() / 2];
+    };
+
+    OverheadCalibration ret;
+    ret.timer = median(timers);
+    ret.nested = std::max(median(enclosing) - ret.timer, 0.) / nested;
+    nbRecordedBenches = recorded;
+    recordedTime = recordedTimeBefore;
+    return ret;
+}
+
+/**
+ * Cost of the instrumentation, measured on the first call (the first dump or
+ * correction) so that a program recording nothing does not pay for it.
+ *
+ * @Note calibrates the TSC clock (see `tscCalibration`) when it is the default
+ *       one. Stays empty when ALGOLIA_PROFILING_CORRECTION is disabled.
+ */
+inline const OverheadCalibration& overheadCalibration() {
+    static const OverheadCalibration calibration =
+        calibrateOverhead<DefaultBenchClock, DefaultBenchInfos>();
+    return calibration;
+}
+#else
+inline const OverheadCalibration& overheadCalibration() {
+    static const OverheadCalibration calibration{};
+    return calibration;
+}
+#endif
+
 // -------------------
 // Environment classes
 // -------------------
@@ -37,42 +158,176 @@ public:
     BenchEnv& operator=(const BenchEnv&) = delete;
     BenchEnv& operator=(BenchEnv&&) = delete;
 
-    template <typename Iterator>
-    void eraseMapCell(const Iterator& it) {
-        _benchesPerThread.erase(it);
+    /**
+     * Dump the content of all the threads into `_out` and flush it using `func`.
+     * Using a functor aims to make the way of registering the bench user side.
+     * 
+     * @Note after this function, the `_out` buffer is cleared.
+     */
+    template <typename Functor>
+    void flushBench(Functor& func) {
+        std::lock_guard<ProfiledMutex> lock(_outMutex);
+
+        for (auto* localEnv = _localEnvs.load(std::memory_order_acquire);
+             localEnv; localEnv = localEnv->next)
+        {
+            localEnv->dump(_writer);
+        }
+
+        func(_out);
+        _out.resize(0);
+        _writer.reset();
     }
 
     /**
-     * Dump the current content of the local tree containing the benches of
-     * the thread represented by `tid` into `_out`. 
+     * Same as `flushBench` but dump the threads in the binary format. `func`
+     * receives a `std::string` holding a complete binary file.
      */
-    auto dumpMapCell(const std::thread::id& tid) {
-        const auto threadBench_it = _benchesPerThread.find(tid);
-        if (threadBench_it != end(_benchesPerThread)) {
-            std::lock_guard<std::mutex> lock(_outMutex);
-            threadBench_it->second->dump(_writer);
+    template <typename Functor>
+    void flushBenchBinary(Functor& func) {
+        std::lock_guard<ProfiledMutex> lock(_outMutex);
+
+        for (auto* localEnv = _localEnvs.load(std::memory_order_acquire);
+             localEnv; localEnv = localEnv->next)
+        {
+            localEnv->dumpBinary(_binaryOut);
         }
 
-        return threadBench_it;
+        func(_binaryOut);
+        resetBinaryOut();
     }
 
     /**
-     * Dump the content of all the threads into `_out` and flush it using `func`.
-     * Using a functor aims to make the way of registering the bench user side.
-     * 
-     * @Note after this function, the `_out` buffer is cleared.
+     * Same as `flushBench` but merge the trees of all the threads by call path
+     * into a single one (see `MergedProfile`), whose nodes also tell how
+     * their time was spread over the threads. `func` receives a JSON array.
+     *
+     * @Note the dying threads are only part of it with `DumpFormat::merged`.
      */
     template <typename Functor>
-    void flushBench(Functor& func) {
-        std::lock_guard<std::mutex> lock(_outMutex);
+    void flushMerged(Functor& func) {
+        std::lock_guard<ProfiledMutex> lock(_outMutex);
 
-        for (auto &threadBench : _benchesPerThread) {
-            threadBench.second->dump(_writer);
+        for (auto* localEnv = _localEnvs.load(std::memory_order_acquire);
+             localEnv; localEnv = localEnv->next)
+        {
+            _profile.add(localEnv->benchTree, threadIdToStr(localEnv->tid));
         }
+        _profile.dump(_writer, overheadCalibration());
 
         func(_out);
         _out.resize(0);
         _writer.reset();
+        _profile.clear();
+    }
+
+    /**
+     * Same as `flushBench` but write the trees as folded stacks (see
+     * BenchFolded.h), ready for flamegraph.pl. `func` receives a `std::string`.
+     *
+     * The threads are merged in the graph, unless the dump format is
+     * `DumpFormat::foldedPerThread`: each stack then starts with its thread
+     * id. The dying threads are only part of it with one of those formats.
+     */
+    template <typename Functor>
+    void flushFolded(Functor& func) {
+        std::lock_guard<ProfiledMutex> lock(_outMutex);
+
+        for (auto* localEnv = _localEnvs.load(std::memory_order_acquire);
+             localEnv; localEnv = localEnv->next)
+        {
+            localEnv->dumpFolded(_foldedOut, _format == DumpFormat::foldedPerThread);
+        }
+
+        func(_foldedOut);
+        _foldedOut.clear();
+    }
+
+    /**
+     * Write the last events of every thread (see BenchTrace.h) as a Chrome
+     * Trace Event JSON file and give it to `func`. The file can be opened in
+     * chrome://tracing or Perfetto.
+     *
+     * @Note only records something when ALGOLIA_PROFILING_TRACE is enabled.
+     */
+    template <typename Functor>
+    void flushTrace(Functor& func) {
+        std::lock_guard<ProfiledMutex> lock(_outMutex);
+
+        for (auto* localEnv = _localEnvs.load(std::memory_order_acquire);
+             localEnv; localEnv = localEnv->next)
+        {
+            localEnv->dumpTrace(_traceOut);
+        }
+
+        _traceOut.append(chromeTraceFooter);
+        func(_traceOut);
+        _traceOut.assign(chromeTraceHeader);
+    }
+
+    /**
+     * Write the statistics of the profiled mutexes (see BenchLock.h) as a JSON
+     * array, one entry per lock name, and give it to `func`. `_outMutex` is
+     * one of them.
+     */
+    template <typename Functor>
+    void flushLocks(Functor& func) {
+        // Not `_out`, which holds the dying threads until `flushBench`
+        OutBuff_t out;
+        JSONWriter writer{ out };
+        LockRegistry::instance().dump(writer);
+        func(out);
+    }
+
+    /**
+     * Start a thread writing the benches to `fd` every `period`, as one JSON
+     * object per line and per batch of subtrees: `{"<thread id>":[...]}`.
+     *
+     * The threads hand their complete subtrees (the ones under the root, when
+     * the tail is the root) over through a lock-free queue, either when they
+     * hold ALGOLIA_PROFILING_STREAM_BATCH of them or when the streaming thread
+     * asks for them. The arena blocks holding those subtrees go along and are
+     * given back to the thread once written, so the memory of a thread stays
+     * bounded. The threads never format anything nor take `_outMutex`.
+     *
+     * @Note a thread hands its subtrees over when it records its next bench.
+     *       Subtrees are only complete at the root: a bunch that never ends
+     *       keeps growing.
+     */
+    void startStreaming(int fd, std::chrono::milliseconds period = std::chrono::milliseconds(100)) {
+        stopStreaming();
+        _streamFd = fd;
+        _stopStreaming = false;
+        _streaming.store(true, std::memory_order_relaxed);
+        _streamer = std::thread([this, period] { streamLoop(period); });
+    }
+
+    /**
+     * Stop the streaming thread after writing the subtrees already handed
+     * over.
+     */
+    void stopStreaming() {
+        if (!_streamer.joinable()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_streamMutex);
+            _stopStreaming = true;
+        }
+        _streamCv.notify_one();
+        _streamer.join();
+        _streaming.store(false, std::memory_order_relaxed);
+        writeBatches();
+    }
+
+    /**
+     * Choose the format used to save the trees of the dying threads until the
+     * next flush. Must match the flush function called.
+     */
+    void setDumpFormat(DumpFormat format) {
+        std::lock_guard<ProfiledMutex> lock(_outMutex);
+        _format = format;
     }
 
     struct BenchLocalEnv {
@@ -82,9 +337,7 @@ public:
         BenchLocalEnv& operator=(BenchLocalEnv&&) = delete;
 
         ~BenchLocalEnv() {
-            auto& env = getEnvInstance<Infos>();
-            const auto& it = env.dumpMapCell(std::this_thread::get_id());
-            env.eraseMapCell(it);
+            getEnvInstance<Infos>().unregisterLocalEnv(this);
         }
 
         static BenchLocalEnv& getInstance() {
@@ -95,10 +348,10 @@ public:
         void dump(JSONWriter& writer) const {
             writer.pushMapStart();
 
-            writer.pushMapKey(threadIdToStr(std::this_thread::get_id()));
+            writer.pushMapKey(threadIdToStr(tid));
             writer.pushArrayStart();
 
-            DumpVisitor<Infos> v{ writer };
+            DumpVisitor<Infos> v{ writer, overheadCalibration() };
             benchTree.accept(v);
 
             writer.pushArrayEnd();
@@ -106,84 +359,205 @@ public:
             writer.pushRaw("}", 1, false);
         }
 
+        void dumpBinary(std::string& out) const {
+            BinaryDumpVisitor<Infos> v{ overheadCalibration() };
+            benchTree.accept(v);
+            v.flush(out, threadIdToStr(tid));
+        }
+
+        void dumpFolded(std::string& out, bool perThread) const {
+            const std::string root = perThread ? threadIdToStr(tid) : std::string();
+            FoldedStackVisitor<Infos> v{ out, root };
+            benchTree.accept(v);
+        }
+
+        void dumpTrace(std::string& out) {
+            if (trace) {
+                trace->foreach([&](const TraceEvent& event) {
+                    pushChromeTraceEvent(out, event, traceTid);
+                });
+                trace->clear();
+            }
+        }
+
+        /**
+         * Keep the event of a finished bench when tracing is enabled.
+         */
+        FORCEINLINE void addTraceEvent(const Infos& infos) {
+            if constexpr (std::is_same_v<TraceStamp_t, TraceStamp>) {
+                if (infos.trace.name) {
+                    trace->add({ infos.trace.name, infos.trace.start, infos.trace.duration });
+                }
+            }
+        }
+
         Tree<Infos> benchTree;
+        const std::thread::id tid = std::this_thread::get_id();
+        // Small sequential id used as `tid` in the trace events
+        AULong traceTid = 0;
+        std::unique_ptr<TraceBuffer> trace;
+
+        // Intrusive link in `BenchEnv::_localEnvs`
+        BenchLocalEnv* next = nullptr;
+        // Set by the streaming thread
+        std::atomic<bool> handoffRequested = false;
+        // Subtrees dropped since the last handoff
+        AULong dropped = 0;
 
     private:
-        BenchLocalEnv() = default;
+        BenchLocalEnv() {
+            if constexpr (std::is_same_v<TraceStamp_t, TraceStamp>) {
+                trace = std::make_unique<TraceBuffer>();
+            }
+            getEnvInstance<Infos>().registerLocalEnv(this);
+        }
     };
 
     /**
-     * Iterates over all the internal nodes of the local tree in order to increase
-     * their elapsed value by the argument `elapsed`.
-     * This function is called when adding a leaf.
+     * Push `localEnv` at the head of the list of local environments.
+     * Lock-free: called once per thread, when its local environment is created.
      */
-    template <class Duration>
-    void increaseParentBench(BenchLocalEnv& localEnv, Duration elapsed) {
-        for (auto* tail = localEnv.benchTree.getTail(); tail->father;
-             tail = tail->father)
-        {
-            tail->value.elapsed += elapsed;
+    void registerLocalEnv(BenchLocalEnv* localEnv) {
+        localEnv->traceTid = _nbLocalEnvs.fetch_add(1, std::memory_order_relaxed);
+        localEnv->next = _localEnvs.load(std::memory_order_relaxed);
+        while (!_localEnvs.compare_exchange_weak(localEnv->next, localEnv,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * Dump the tree of `localEnv` into `_out` and unlink it from the list of
+     * local environments.
+     *
+     * @Note registrations only ever touch the head of the list, removals are
+     *       serialized by `_outMutex`. Therefore only the head needs a CAS.
+     */
+    void unregisterLocalEnv(BenchLocalEnv* localEnv) {
+        std::lock_guard<ProfiledMutex> lock(_outMutex);
+        auto& tree = localEnv->benchTree;
+        if (_streaming.load(std::memory_order_relaxed) && tree.isRoot()) {
+            if (tree.getTail()->children.size() > 0) {
+                handoff(*localEnv);
+            }
+        } else if (_format == DumpFormat::binary) {
+            localEnv->dumpBinary(_binaryOut);
+        } else if (_format == DumpFormat::merged) {
+            _profile.add(tree, threadIdToStr(localEnv->tid));
+        } else if (_format == DumpFormat::folded
+                   || _format == DumpFormat::foldedPerThread) {
+            localEnv->dumpFolded(_foldedOut, _format == DumpFormat::foldedPerThread);
+        } else {
+            localEnv->dump(_writer);
+        }
+        localEnv->dumpTrace(_traceOut);
+
+        BenchLocalEnv* expected = localEnv;
+        if (_localEnvs.compare_exchange_strong(expected, localEnv->next,
+                                               std::memory_order_acq_rel)) {
+            return;
+        }
+
+        // `localEnv` is not the head anymore, new registrations only add
+        // nodes in front of it.
+        for (auto* prev = expected; prev; prev = prev->next) {
+            if (prev->next == localEnv) {
+                prev->next = localEnv->next;
+                return;
+            }
         }
     }
 
     /**
      * Create a leaf with the attributes from `infos` as value.
-     * If the local tree was not already registered in the global environment, add it.
+     * With aggregated infos, `infos` is merged into the sibling leaf created
+     * from the same call site if there is one. The leaf goes into the
+     * context attached to the thread instead, if any (see `BenchContext`).
      * 
-     * @return the value inside the newly created node.
+     * @return the value inside the newly created node. When streaming, it is
+     *         only valid until the next bench of the thread.
      */
     Infos& addLeaf(Infos&& infos) {
+        if (auto* context = BenchContext<Infos>::current()) {
+            countRecorded();
+            return context->addLeaf(std::move(infos));
+        }
+
         auto& localBenches = BenchLocalEnv::getInstance();
-        increaseParentBench(localBenches, infos.elapsed);
+        maybeHandoff(localBenches, &infos);
+        countRecorded();
+        localBenches.addTraceEvent(infos);
+        if constexpr (is_aggregated_v<Infos>) {
+            return localBenches.benchTree.mergeLeaf(std::forward<Infos>(infos));
+        }
         auto& ret = localBenches.benchTree.addLeaf(std::forward<Infos>(infos));
-        _benchesPerThread.insert({ std::this_thread::get_id(), &localBenches });
 
         return ret;
     }
 
     /**
      * Emplace a leaf with the attributes given in argument.
-     * If the local tree was not already registered in the global environment, add it.
      * 
      * @return the value inside the newly created node.
      */
     template <class Duration, typename... Args>
     Infos& emplaceLeaf(const Duration& elapsed, Args&&... args) {
+        if (auto* context = BenchContext<Infos>::current()) {
+            countRecorded();
+            return context->addLeaf(Infos{ elapsed, std::forward<Args>(args)... });
+        }
+
         auto& localBenches = BenchLocalEnv::getInstance();
-        increaseParentBench(localBenches, elapsed);
+        maybeHandoff(localBenches);
+        countRecorded();
+        if constexpr (is_aggregated_v<Infos>) {
+            return localBenches.benchTree.mergeLeaf(Infos{ elapsed, std::forward<Args>(args)... });
+        }
         auto& ret = localBenches.benchTree.addLeaf(elapsed, std::forward<Args>(args)...);
-        _benchesPerThread.insert({ std::this_thread::get_id(), &localBenches });
 
         return ret;
     }
 
     /**
      * Add an internal node the attributes from `infos` as value.
-     * If the local tree was not already registered in the global environment, add it.
      * 
      * @return the value inside the newly created node.
      */
     Infos& addSubLevel(Infos&& infos) {
+        if (auto* context = BenchContext<Infos>::current()) {
+            countRecorded();
+            return context->addSubLevel(std::move(infos));
+        }
+
         auto& localBenches = BenchLocalEnv::getInstance();
-        increaseParentBench(localBenches, infos.elapsed);
+        maybeHandoff(localBenches);
+        countRecorded();
+        if constexpr (is_aggregated_v<Infos>) {
+            return localBenches.benchTree.mergeInternal(std::forward<Infos>(infos));
+        }
         auto& ret = localBenches.benchTree.addInternal(std::forward<Infos>(infos));
-        _benchesPerThread.insert({ std::this_thread::get_id(), &localBenches });
 
         return ret;
     }
 
     /**
      * Emplace an internal node with the attributes given in argument.
-     * If the local tree was not already registered in the global environment, add it.
      * 
      * @return the value inside the newly created node.
      */
     template <class Duration, typename... Args>
     Infos& emplaceSubLevel(const Duration& elapsed, Args&&... args) {
+        if (auto* context = BenchContext<Infos>::current()) {
+            countRecorded();
+            return context->addSubLevel(Infos{ elapsed, std::forward<Args>(args)... });
+        }
+
         auto& localBenches = BenchLocalEnv::getInstance();
-        increaseParentBench(localBenches, elapsed);
+        maybeHandoff(localBenches);
+        countRecorded();
+        if constexpr (is_aggregated_v<Infos>) {
+            return localBenches.benchTree.mergeInternal(Infos{ elapsed, std::forward<Args>(args)... });
+        }
         auto& ret = localBenches.benchTree.addInternal(elapsed, std::forward<Args>(args)...);
-        _benchesPerThread.insert({ std::this_thread::get_id(), &localBenches });
 
         return ret;
     }
@@ -195,19 +569,208 @@ public:
      * @Note Typically called by the destructor of `BenchBunch`.
      */
     void endSubLevel() {
+        if (auto* context = BenchContext<Infos>::current()) {
+            context->endSubLevel();
+            return;
+        }
+
         auto& localBenches = BenchLocalEnv::getInstance();
+        // The elapsed time of a bunch is only known when dumped, its event
+        // spans from its opening to now instead
+        if constexpr (std::is_same_v<TraceStamp_t, TraceStamp>) {
+            auto& infos = localBenches.benchTree.getTail()->value;
+            infos.trace.duration =
+                DefaultBenchClock::timestamp(DefaultBenchClock::stop()) - infos.trace.start;
+            localBenches.addTraceEvent(infos);
+        }
         localBenches.benchTree.goUp();
     }
 
 private:
     BenchEnv() 
-        : _writer(_out) { }
+        : _writer(_out), _traceOut(chromeTraceHeader) {
+        resetBinaryOut();
+    }
+
+    ~BenchEnv() { stopStreaming(); }
+
+    /**
+     * Complete subtrees of a thread and the arena blocks holding them.
+     * Allocated in those blocks.
+     */
+    struct StreamBatch {
+        StreamBatch(typename Tree<Infos>::Subtrees subtrees_, std::thread::id tid_, AULong dropped_)
+            : subtrees(std::move(subtrees_)), tid(tid_), dropped(dropped_) {}
+
+        typename Tree<Infos>::Subtrees subtrees;
+        std::thread::id tid;
+        AULong dropped; // Subtrees dropped before this batch
+        Arena::Block* blocks = nullptr;
+        std::shared_ptr<Arena::RecycleBin> bin;
+        StreamBatch* next = nullptr;
+    };
+
+    FORCEINLINE void maybeHandoff(BenchLocalEnv& localEnv, Infos* pending = nullptr) {
+        if (!_streaming.load(std::memory_order_relaxed) || !localEnv.benchTree.isRoot()) {
+            return;
+        }
+
+        const std::size_t nbSubtrees = localEnv.benchTree.getTail()->children.size();
+        if (nbSubtrees >= ALGOLIA_PROFILING_STREAM_BATCH
+            || (nbSubtrees > 0 && localEnv.handoffRequested.load(std::memory_order_relaxed)))
+        {
+            handoff(localEnv, pending);
+        }
+    }
+
+    /**
+     * Push the complete subtrees of `localEnv` into `_batches`, along with
+     * every block of the thread's arena. Skipped while a running bench object
+     * holds memory of the arena, except `pending`, the infos being added,
+     * whose comments and metrics are moved to the new blocks.
+     */
+    void handoff(BenchLocalEnv& localEnv, Infos* pending = nullptr) {
+        auto& arena = localArena<Infos>();
+        const bool pendingPin = pending && holdsArena(*pending);
+        if (arena.pins() > AULong(pendingPin)) {
+            return;
+        }
+        localEnv.handoffRequested.store(false, std::memory_order_relaxed);
+
+        const auto& bin = arena.recycleBin();
+        StreamBatch* batch = nullptr;
+        if (bin->inFlight() < ALGOLIA_PROFILING_STREAM_MAX_BYTES) {
+            batch = arena.template create<StreamBatch>(localEnv.benchTree.detachRoot(),
+                                              localEnv.tid, localEnv.dropped);
+            localEnv.dropped = 0;
+        } else {
+            // The streaming thread is late, drop the subtrees instead of growing
+            localEnv.dropped += localEnv.benchTree.detachRoot().size();
+        }
+        Arena::Block* blocks = arena.detach();
+
+        if (pendingPin) {
+            // Before the old blocks are reused or recycled
+            typename Infos::Comments_t comments;
+            comments.reserve(pending->comments.size());
+            for (auto& comment : pending->comments) {
+                comments.push_back(std::move(comment));
+            }
+            pending->comments.swap(comments);
+
+            typename Infos::Metrics_t metrics(pending->metrics.begin(), pending->metrics.end());
+            pending->metrics.swap(metrics);
+        }
+
+        if (!batch) {
+            arena.reuse(blocks);
+            return;
+        }
+
+        batch->blocks = blocks;
+        batch->bin = bin;
+        bin->handedOver(blocks);
+        batch->next = _batches.load(std::memory_order_relaxed);
+        while (!_batches.compare_exchange_weak(batch->next, batch,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {}
+    }
+
+    void streamLoop(std::chrono::milliseconds period) {
+        std::unique_lock<std::mutex> lock(_streamMutex);
+        while (!_stopStreaming) {
+            _streamCv.wait_for(lock, period, [this] { return _stopStreaming; });
+
+            {
+                std::lock_guard<ProfiledMutex> outLock(_outMutex);
+                for (auto* localEnv = _localEnvs.load(std::memory_order_acquire);
+                     localEnv; localEnv = localEnv->next)
+                {
+                    localEnv->handoffRequested.store(true, std::memory_order_relaxed);
+                }
+            }
+            writeBatches();
+        }
+    }
+
+    /**
+     * Write the batches handed over to `_streamFd`, in the order they were
+     * pushed, then give their blocks back to their arena.
+     */
+    void writeBatches() {
+        StreamBatch* batches = nullptr;
+        for (auto* batch = _batches.exchange(nullptr, std::memory_order_acquire); batch;) {
+            auto* next = batch->next;
+            batch->next = batches;
+            batches = batch;
+            batch = next;
+        }
+
+        for (auto* batch = batches; batch;) {
+            _streamWriter.pushMapStart();
+            _streamWriter.pushMapKey(threadIdToStr(batch->tid));
+            _streamWriter.pushArrayStart();
+            DumpVisitor<Infos> v{ _streamWriter, overheadCalibration() };
+            Tree<Infos>::accept(batch->subtrees, v);
+            _streamWriter.pushArrayEnd();
+            if (batch->dropped) {
+                _streamWriter.pushMapKeyConst("dropped");
+                _streamWriter.pushString(std::to_string(batch->dropped));
+            }
+            _streamWriter.pushRaw("}\n", 2, false);
+
+            auto* next = batch->next;
+            auto* blocks = batch->blocks;
+            auto bin = std::move(batch->bin);
+            batch->~StreamBatch(); // Destroys the nodes
+            bin->recycle(blocks);
+            batch = next;
+        }
+
+        const char* data = _streamOut.data();
+        std::size_t size = _streamOut.size();
+        while (size > 0) {
+            const ssize_t n = write(_streamFd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            data += n;
+            size -= n;
+        }
+        _streamOut.resize(0);
+        _streamWriter.reset();
+    }
+
+    void resetBinaryOut() {
+        _binaryOut.assign(binary::magic, sizeof(binary::magic));
+        binary::putVarint(_binaryOut, binary::version);
+    }
 
     JSONWriter _writer;
     OutBuff_t _out;
-
-    std::unordered_map<std::thread::id, const BenchLocalEnv* > _benchesPerThread;
-    std::mutex _outMutex;
+    std::string _binaryOut;
+    MergedProfile _profile; // Dead threads, with `DumpFormat::merged`
+    std::string _foldedOut;
+    DumpFormat _format = DumpFormat::json;
+    std::string _traceOut;
+    std::atomic<AULong> _nbLocalEnvs = 0;
+
+    std::atomic<BenchLocalEnv*> _localEnvs = nullptr;
+    ProfiledMutex _outMutex{ "bench::BenchEnv::_outMutex" };
+
+    // Streaming, see `startStreaming`
+    std::atomic<bool> _streaming = false;
+    std::atomic<StreamBatch*> _batches = nullptr;
+    int _streamFd = -1;
+    OutBuff_t _streamOut;
+    JSONWriter _streamWriter{ _streamOut };
+    std::thread _streamer;
+    std::mutex _streamMutex;
+    std::condition_variable _streamCv;
+    bool _stopStreaming = false;
 };
 #else
 template <typename Infos>
@@ -220,13 +783,29 @@ public:
     BenchEnv& operator=(const BenchEnv&) = delete;
     BenchEnv& operator=(BenchEnv&&) = delete;
 
-    template <typename Iterator>
-    void eraseMapCell(const Iterator&) {}
-    auto dumpMapCell(const std::thread::id&) {}
-
     template <typename Functor>
     void flushBench(Functor& func) {}
 
+    template <typename Functor>
+    void flushBenchBinary(Functor& func) {}
+
+    template <typename Functor>
+    void flushMerged(Functor& func) {}
+
+    template <typename Functor>
+    void flushFolded(Functor& func) {}
+
+    template <typename Functor>
+    void flushTrace(Functor& func) {}
+
+    template <typename Functor>
+    void flushLocks(Functor& func) {}
+
+    void setDumpFormat(DumpFormat) {}
+
+    void startStreaming(int, std::chrono::milliseconds = std::chrono::milliseconds(100)) {}
+    void stopStreaming() {}
+
     struct BenchLocalEnv {
         BenchLocalEnv(const BenchLocalEnv&) = delete;
         BenchLocalEnv(BenchLocalEnv&&) = delete;
@@ -241,10 +820,11 @@ public:
         }
 
         void dump(JSONWriter& writer) const {}
+        void dumpBinary(std::string&) const {}
     };
 
-    template <class Duration>
-    void increaseParentBench(BenchLocalEnv&, Duration) {}
+    void registerLocalEnv(BenchLocalEnv*) {}
+    void unregisterLocalEnv(BenchLocalEnv*) {}
 
     void addLeaf(Infos&&) {}
 
@@ -268,7 +848,7 @@ private:
  * if multiple threads attempt to initialize the same static local variable
  * concurrently, the initialization occurs exactly once.
  */
-template <typename Infos = BenchInfos>
+template <typename Infos = DefaultBenchInfos>
 static BenchEnv<Infos>& getEnvInstance() {
     static BenchEnv<Infos> env;
     return env;
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <assert.h>
+
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/bench/BenchInfos.h"
+#include "utils/bench/BenchTree.h"
+
+namespace bench {
+
+/**
+ * Same as `Tree` but stored as a single array of nodes in pre-order. Each node
+ * knows its parent, its depth and the size of its subtree: the children of
+ * node `i` are the nodes of `(i, i + size)` one level deeper, its next sibling
+ * is `i + size`, and the tree is walked with a linear scan instead of chasing
+ * pointers. The inclusive values of the internal nodes are computed by a
+ * single reverse scan (see `FlatDumpVisitor`).
+ *
+ * The insertion is stack-like as with `Tree`, so appending a node is O(1).
+ * The size of an internal node is only known when `goUp` closes it, it is 0
+ * meanwhile (see `end`).
+ *
+ * @Note the array grows like a `std::vector`: the references returned by the
+ *       modifiers are only valid until the next insertion, and the growth goes
+ *       through the heap. `BenchEnv` keeps using `Tree`, whose bunches hold a
+ *       pointer to their node.
+ * @Note with aggregated infos, a bunch is only merged into its sibling from
+ *       the same call site when that sibling's subtree ends the array, its new
+ *       children could not follow it otherwise. A new sibling is added instead.
+ */
+template <class T>
+class FlatTree {
+public:
+    static constexpr AUInt npos = ~AUInt(0);
+
+    struct Node {
+        T value;
+        AUInt parent; // `npos` for the top level nodes
+        AUInt size; // Nodes of the subtree, itself included, 0 while open
+        AUInt depth;
+        bool internal;
+    };
+
+    FlatTree() = default;
+    FlatTree(const FlatTree&) = delete;
+    FlatTree& operator=(const FlatTree&) = delete;
+
+    // -----------------
+    // Modifiers methods
+    // -----------------
+    template <typename... Args> // Supports both emplace and move constructor
+    T& addInternal(Args&&... args) {
+        T& ret = append(true, std::forward<Args>(args)...);
+        _tail = AUInt(_nodes.size() - 1);
+        return ret;
+    }
+
+    template <typename... Args> // Supports both emplace and move constructor
+    T& addLeaf(Args&&... args) {
+        return append(false, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Same as `Tree::mergeLeaf`.
+     */
+    T& mergeLeaf(T&& infos) {
+        const auto [it, inserted] = _index.try_emplace({ _tail, infos.key() }, npos);
+        if (!inserted && !_nodes[it->second].internal) {
+            T& leaf = _nodes[it->second].value;
+            leaf.addSample(std::forward<T>(infos));
+            return leaf;
+        }
+
+        it->second = AUInt(_nodes.size());
+        T& ret = addLeaf(std::forward<T>(infos));
+        ret.firstSample();
+        return ret;
+    }
+
+    /**
+     * Same as `Tree::mergeInternal`, see the class notes.
+     */
+    T& mergeInternal(T&& infos) {
+        const auto [it, inserted] = _index.try_emplace({ _tail, infos.key() }, npos);
+        if (!inserted) {
+            Node& internal = _nodes[it->second];
+            if (internal.internal && it->second + internal.size == _nodes.size()) {
+                internal.value.addSample(std::forward<T>(infos));
+                internal.size = 0;
+                _tail = it->second;
+                return internal.value;
+            }
+        }
+
+        it->second = AUInt(_nodes.size());
+        T& ret = addInternal(std::forward<T>(infos));
+        ret.firstSample();
+        return ret;
+    }
+
+    // Avoid the copies of the array while it grows
+    void reserve(AUInt nodes) { _nodes.reserve(nodes); }
+
+    void goUp() {
+        assert(_tail != npos);
+        Node& internal = _nodes[_tail];
+        internal.size = AUInt(_nodes.size()) - _tail;
+        _tail = internal.parent;
+    }
+
+    // ---------
+    // Accessors
+    // ---------
+    AUInt size() const { return AUInt(_nodes.size()); }
+    bool isRoot() const { return _tail == npos; }
+    const std::vector<Node>& nodes() const { return _nodes; }
+
+    // One past the last node of the subtree of `i`
+    AUInt end(AUInt i) const {
+        const AUInt size = _nodes[i].size;
+        return size ? i + size : AUInt(_nodes.size());
+    }
+
+    // -------
+    // Process
+    // -------
+    template <typename V>
+    void accept(V&& v) const { v.visit(*this); }
+
+private:
+    template <typename... Args>
+    T& append(bool internal, Args&&... args) {
+        const AUInt depth = _tail == npos ? 0 : _nodes[_tail].depth + 1;
+        _nodes.push_back(Node{ T{std::forward<Args>(args)...}, _tail,
+                               internal ? 0u : 1u, depth, internal });
+        return _nodes.back().value;
+    }
+
+    // Call site of a node under a given parent
+    struct Key {
+        AUInt parent;
+        CallSite site;
+
+        bool operator==(const Key& o) const { return parent == o.parent && site == o.site; }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& k) const {
+            std::size_t h = CallSiteHash{}(k.site);
+            h ^= std::hash<AUInt>{}(k.parent) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h;
+        }
+    };
+
+    struct NoIndex {};
+    using Index = std::conditional_t<is_aggregated_v<T>,
+        std::unordered_map<Key, AUInt, KeyHash>, NoIndex>;
+
+    std::vector<Node> _nodes;
+    AUInt _tail = npos;
+    Index _index;
+};
+
+/**
+ * Same output as `DumpVisitor` for a `FlatTree`, written with a linear scan.
+ */
+template <class Infos>
+struct FlatDumpVisitor {
+    FlatDumpVisitor(JSONWriter& writer, const OverheadCalibration& calibration = {})
+        : dumper(writer, calibration) {}
+
+    void visit(const FlatTree<Infos>& tree) {
+        const auto& nodes = tree.nodes();
+
+        // The children come after their parent: a reverse scan is post-order
+        inclusive.assign(nodes.size(), Inclusive{});
+        for (AUInt i = nodes.size(); i-- > 0;) {
+            inclusive[i] += Inclusive::of(nodes[i].value);
+            if (nodes[i].parent != FlatTree<Infos>::npos) {
+                inclusive[nodes[i].parent] += inclusive[i];
+            }
+        }
+
+        JSONWriter& writer = dumper.writer;
+        open.clear();
+        for (AUInt i = 0; i < nodes.size(); ++i) {
+            for (; !open.empty() && i >= open.back(); open.pop_back()) {
+                writer.pushArrayEnd();
+                writer.pushMapEnd();
+            }
+
+            writer.pushMapStart();
+            dumper.dumpInfos(nodes[i].value, inclusive[i]);
+            if (nodes[i].internal) {
+                writer.pushMapKeyConst("sub");
+                writer.pushArrayStart();
+                open.push_back(tree.end(i));
+                continue;
+            }
+            if constexpr (is_aggregated_v<Infos>) {
+                dumper.dumpStats(nodes[i].value);
+            }
+            writer.pushMapEnd();
+        }
+
+        for (; !open.empty(); open.pop_back()) {
+            writer.pushArrayEnd();
+            writer.pushMapEnd();
+        }
+    }
+
+    DumpVisitor<Infos> dumper; // Formats the nodes
+    std::vector<Inclusive> inclusive;
+    std::vector<AUInt> open; // End of the internal nodes being written
+};
+
+} // namespace bench
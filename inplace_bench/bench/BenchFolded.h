@@ -0,0 +1,111 @@
+#pragma once
+
+#include <charconv>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "utils/bench/BenchTree.h"
+
+namespace bench {
+
+// --------------------
+// Folded stacks export
+// --------------------
+
+/**
+ * Write a tree in the folded stacks format of Brendan Gregg's flame graph
+ * tools: one `root;a;b;c <self ns>` line per node having some self time.
+ * The lines are written straight into `out` from the stack of the names
+ * being visited, no string is built per path.
+ *
+ * The self time of a leaf is its elapsed time minus the time of the benches
+ * recorded while it measured: a scope nested in another one is recorded as
+ * its sibling (see `Overhead::nestedTime`). The one of a bunch is zero (only
+ * its children are measured, see `Inclusive`), so only the leaves give lines. The flame graph tools add up identical stacks: the trees of several
+ * threads give a merged graph unless each has its own `root` frame.
+ *
+ * @Note ';' and line breaks in the names are replaced by '_'. The self time
+ *       is the elapsed time when ALGOLIA_PROFILING_CORRECTION is disabled.
+ */
+template <class Infos>
+struct FoldedStackVisitor : public Tree<Infos>::template Visitor<FoldedStackVisitor<Infos>> {
+    using Node = typename Tree<Infos>::Node;
+    using InternalNode = typename Tree<Infos>::InternalNode;
+    using Flush = std::function<void(std::string&)>;
+
+    /**
+     * @param root_ first frame of every stack (e.g. a thread id), if not empty.
+     * @param flush_ if set, called with `out` each time it holds more than
+     *        `chunk_` bytes, `out` is cleared afterwards. The last lines are
+     *        left in `out`.
+     */
+    explicit FoldedStackVisitor(std::string& out_, std::string_view root_ = {},
+                                Flush flush_ = {}, std::size_t chunk_ = 1 << 20)
+        : out(out_), root(root_), flush(std::move(flush_)), chunk(chunk_) {}
+
+    void visit(const Node& n) {
+        writeLine(n.value.name, selfTime(n.value));
+    }
+
+    void visit(const InternalNode& n) {
+        writeLine(n.value.name, selfTime(n.value));
+
+        stack.push_back(n.value.name);
+        n.children.foreach([&](auto&& child) {
+            child.accept(*this);
+        });
+        stack.pop_back();
+    }
+
+private:
+    static std::chrono::nanoseconds selfTime(const Infos& infos) {
+        if constexpr (std::is_same_v<Overhead_t, Overhead>) {
+            return infos.elapsed - infos.overhead.nestedTime;
+        }
+        return infos.elapsed;
+    }
+
+    void writeLine(const char* name, std::chrono::nanoseconds self) {
+        if (self.count() <= 0) {
+            return;
+        }
+
+        if (!root.empty()) {
+            appendFrame(root);
+            out.push_back(';');
+        }
+        for (const char* frame : stack) {
+            appendFrame(frame);
+            out.push_back(';');
+        }
+        appendFrame(name);
+        out.push_back(' ');
+
+        char count[24];
+        const auto [end, ec] = std::to_chars(count, count + sizeof(count), self.count());
+        out.append(count, end);
+        out.push_back('\n');
+
+        if (flush && out.size() > chunk) {
+            flush(out);
+            out.clear();
+        }
+    }
+
+    void appendFrame(std::string_view frame) {
+        for (const char c : frame) {
+            out.push_back(c == ';' || c == '\n' ? '_' : c);
+        }
+    }
+
+    std::string& out;
+    std::string_view root;
+    Flush flush;
+    std::size_t chunk;
+    std::vector<const char*> stack; // Names of the bunches being visited
+};
+
+} // namespace bench
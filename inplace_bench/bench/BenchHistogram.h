@@ -0,0 +1,108 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace bench {
+
+/**
+ * Log-linear (HDR-style) histogram of durations in nanoseconds.
+ *
+ * Values below 256ns are counted exactly. Above, every power of two is split
+ * into 128 buckets, so a recorded value is known with a relative error below
+ * 0.8%. Values up to 2^42ns (~73 minutes) are tracked, bigger values fall in
+ * the last bucket but still update `max`.
+ *
+ * The memory is fixed (~36KB) and recording a value is a count leading zeros,
+ * a shift and an increment. The buckets are 64 bits wide like the total: the
+ * weight of a sampled value or the merge of long-running threads does not
+ * wrap them.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned subBucketBits = 7;
+    static constexpr unsigned subBucketCount = 1u << subBucketBits;
+    // Values below `linearCount` are stored one per bucket
+    static constexpr unsigned linearBits = subBucketBits + 1;
+    static constexpr AULong linearCount = AULong(1) << linearBits;
+    static constexpr unsigned maxExponent = 41;
+    static constexpr std::size_t bucketCount =
+        linearCount + (maxExponent - linearBits + 1) * subBucketCount;
+
+    // `count` is greater than 1 for a sampled value (see BenchSampling.h)
+    FORCEINLINE void record(AULong ns, AULong count = 1) {
+        _counts[index(ns)] += count;
+        _total += count;
+        _max = std::max(_max, ns);
+    }
+
+    /**
+     * Add the samples of `o` into this histogram. Merging is exact since both
+     * histograms share the same buckets.
+     */
+    void merge(const LatencyHistogram& o) {
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            _counts[i] += o._counts[i];
+        }
+        _total += o._total;
+        _max = std::max(_max, o._max);
+    }
+
+    /**
+     * @return the highest value equivalent to the sample at `percentile`
+     *         (between 0 and 100), clipped to the maximum recorded value.
+     */
+    AULong valueAt(double percentile) const {
+        if (_total == 0) {
+            return 0;
+        }
+
+        const AULong target = std::max<AULong>(1,
+            AULong(std::ceil(percentile / 100. * _total)));
+        AULong seen = 0;
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            seen += _counts[i];
+            if (seen >= target) {
+                // The last bucket also holds the values out of range
+                return i == bucketCount - 1 ? _max : std::min(highestEquivalent(i), _max);
+            }
+        }
+
+        return _max;
+    }
+
+    AULong total() const { return _total; }
+    AULong max() const { return _max; }
+
+private:
+    static FORCEINLINE std::size_t index(AULong ns) {
+        if (ns < linearCount) {
+            return ns;
+        }
+
+        const unsigned exponent = std::min<unsigned>(63 - __builtin_clzll(ns), maxExponent);
+        const unsigned shift = exponent - subBucketBits;
+        const std::size_t sub = std::min<AULong>(ns >> shift, 2 * subBucketCount - 1) - subBucketCount;
+        return linearCount + (exponent - linearBits) * subBucketCount + sub;
+    }
+
+    static AULong highestEquivalent(std::size_t i) {
+        if (i < linearCount) {
+            return i;
+        }
+
+        const std::size_t exponent = (i - linearCount) / subBucketCount + linearBits;
+        const std::size_t sub = (i - linearCount) % subBucketCount + subBucketCount;
+        const unsigned shift = exponent - subBucketBits;
+        return ((AULong(sub) + 1) << shift) - 1;
+    }
+
+    std::array<AULong, bucketCount> _counts{};
+    AULong _total = 0;
+    AULong _max = 0;
+};
+
+} // namespace bench
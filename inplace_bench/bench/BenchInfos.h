@@ -1,40 +1,418 @@
 #pragma once
 
 #include "utils/bench/BenchUtils.h"
+#include "utils/bench/BenchAllocations.h"
+#include "utils/bench/BenchArena.h"
+#include "utils/bench/BenchCounters.h"
+#include "utils/bench/BenchCpuTime.h"
+#include "utils/bench/BenchTrace.h"
+#include "utils/bench/BenchHistogram.h"
+#include "utils/bench/BenchOverhead.h"
 
-#include <string>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 namespace bench {
 
+// --------
+// Comments
+// --------
+
+/**
+ * Value of a comment. Numbers and literals are stored as they are and only
+ * formatted when dumped, so that commenting a bench does not allocate. Other
+ * strings are copied.
+ */
+using CommentValue = std::variant<long long, unsigned long long, double,
+                                  const char*, std::string>;
+
+struct Comment {
+    const char* key; // Literal, like the bench names
+    CommentValue value;
+};
+
+// Comments of an `Infos` object, in the arena of its trees
+template <typename Infos>
+using Comments = std::vector<Comment, ArenaAllocator<Comment, Infos>>;
+
+template <typename Value>
+static CommentValue makeCommentValue(Value&& value) {
+    using V = std::remove_cv_t<std::remove_reference_t<Value>>;
+    static_assert(std::is_arithmetic_v<V> || std::is_convertible_v<Value, std::string>,
+                  "Invalid Value type");
+    if constexpr (std::is_floating_point_v<V>) {
+        return double(value);
+    } else if constexpr (std::is_integral_v<V> && std::is_signed_v<V>) {
+        return static_cast<long long>(value);
+    } else if constexpr (std::is_integral_v<V>) {
+        return static_cast<unsigned long long>(value);
+    } else if constexpr (std::is_array_v<std::remove_reference_t<Value>>) {
+        return static_cast<const char*>(value); // Literal
+    } else {
+        return std::string(std::forward<Value>(value));
+    }
+}
+
+/**
+ * Format `value` for the dumps.
+ */
+[[maybe_unused]] static std::string commentToString(const CommentValue& value) {
+    return std::visit([](const auto& v) -> std::string {
+        using V = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<V, std::string>) {
+            return v;
+        } else if constexpr (std::is_same_v<V, const char*>) {
+            return std::string(v);
+        } else {
+            return std::to_string(v);
+        }
+    }, value);
+}
+
+// -------
+// Metrics
+// -------
+
+/**
+ * Counter of a bench given by the user (bytes, items, ...), summed over the
+ * calls adding to it. It stays an integer until a floating point value is
+ * added to it. Like the comments, it is only formatted when dumped, along with
+ * its rate over the elapsed time of the node (see `DumpVisitor`).
+ */
+struct Metric {
+    const char* key; // Literal, like the bench names
+    std::variant<ALong, double> value;
+
+    template <typename Value>
+    static Metric make(const char* key, Value value) {
+        static_assert(std::is_arithmetic_v<Value>, "Invalid Value type");
+        if constexpr (std::is_integral_v<Value>) {
+            return { key, static_cast<ALong>(value) };
+        } else {
+            return { key, double(value) };
+        }
+    }
+
+    template <typename Value>
+    void add(Value v) {
+        if constexpr (std::is_integral_v<Value>) {
+            if (auto* i = std::get_if<ALong>(&value)) {
+                *i += static_cast<ALong>(v);
+                return;
+            }
+        }
+        value = toDouble() + double(v);
+    }
+
+    void scale(AULong factor) {
+        std::visit([&](auto& v) { v *= std::decay_t<decltype(v)>(factor); }, value);
+    }
+
+    double toDouble() const {
+        return std::visit([](auto v) { return double(v); }, value);
+    }
+
+    std::string toString() const {
+        return std::visit([](auto v) { return std::to_string(v); }, value);
+    }
+};
+
+template <typename Infos>
+using Metrics = std::vector<Metric, ArenaAllocator<Metric, Infos>>;
+
+// Key of the metric counted by `addItems`, its time per item is dumped too
+static constexpr const char itemsMetric[] = "items";
+
+/**
+ * Add `value` to the metric `key` of `metrics`, created if needed.
+ */
+template <typename Alloc, typename Value>
+static void addMetric(std::vector<Metric, Alloc>& metrics, const char* key, Value value) {
+    auto it = std::find_if(metrics.begin(), metrics.end(), [&](const auto& m) {
+        return m.key == key || std::strcmp(m.key, key) == 0;
+    });
+    if (it == metrics.end()) {
+        metrics.push_back(Metric::make(key, value));
+    } else {
+        it->add(value);
+    }
+}
+
+template <typename Alloc>
+static void addMetrics(std::vector<Metric, Alloc>& metrics, const std::vector<Metric, Alloc>& o) {
+    for (const auto& metric : o) {
+        std::visit([&](auto v) { addMetric(metrics, metric.key, v); }, metric.value);
+    }
+}
+
 // -------------
 // Infos classes
 // -------------
 
+/**
+ * @Note the name and the comment keys are the literals given to the bench
+ *       objects: they are neither copied nor hashed when a bench is recorded.
+ */
 struct BenchInfos {
-    using Key_t = std::string;
-    using Value_t = std::string;
-    using Comment_t  = std::pair<Key_t, Value_t>;
-
-    std::chrono::nanoseconds elapsed;
-    const std::string name;
-    std::vector<Comment_t> comments;
-
-    template <typename Key, typename Value>
-    void addComment(Key&& key, Value&& value) {
-        static_assert(std::is_convertible_v<Key, std::string>,
-                      "Invalid Key type");
-        static_assert(std::is_arithmetic_v<std::remove_reference_t<Value>>
-                      || std::is_convertible_v<Value, std::string>,
-                      "Invalid Value type");
-        if constexpr (std::is_arithmetic_v<std::remove_reference_t<Value>>) {
-            comments.emplace_back(std::forward<Key>(key),
-                                  std::to_string(value));
+    using Comment_t = Comment;
+    using Comments_t = Comments<BenchInfos>;
+    using Metrics_t = Metrics<BenchInfos>;
+
+    std::chrono::nanoseconds elapsed{};
+    const char* name = nullptr;
+    Comments_t comments;
+    Metrics_t metrics;
+    Counters_t counters{};
+    Allocations_t allocations{};
+    CpuTime_t cpuTime{};
+    Overhead_t overhead{};
+    TraceStamp_t trace{};
+
+    BenchInfos() = default;
+
+    explicit BenchInfos(const char* name_) : name(name_) {}
+
+    BenchInfos(std::chrono::nanoseconds elapsed_, const char* name_, Comments_t comments_ = {})
+        : elapsed(elapsed_), name(name_), comments(std::move(comments_)) {}
+
+    template <std::size_t N, typename Value>
+    void addComment(const char (&key)[N], Value&& value) {
+        comments.push_back({ key, makeCommentValue(std::forward<Value>(value)) });
+    }
+
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&key)[N], Value value) {
+        addMetric(metrics, key, value);
+    }
+};
+
+/**
+ * Identify a bench object by its name and the place where it was created.
+ * Names are literal strings so pointers are compared instead of contents.
+ */
+struct CallSite {
+    const char* name;
+    const char* file;
+    unsigned line;
+
+    bool operator==(const CallSite& o) const {
+        return name == o.name && file == o.file && line == o.line;
+    }
+};
+
+struct CallSiteHash {
+    std::size_t operator()(const CallSite& c) const {
+        std::size_t h = std::hash<const void*>{}(c.name);
+        h ^= std::hash<const void*>{}(c.file) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h ^= std::hash<unsigned>{}(c.line) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+/**
+ * Infos merging every sibling bench created from the same call site into a
+ * single node. The memory used is bounded by the number of distinct call
+ * paths instead of the number of calls.
+ *
+ * `elapsed` is the total time of all the merged samples. The statistics are
+ * computed online (Welford's algorithm) when a sample is merged and every
+ * sample is recorded into a `LatencyHistogram` to get the tail latencies.
+ * The histogram is only allocated for the node stored in the tree, not for
+ * the temporary infos of a running bench object.
+ *
+ * A sampled bench (see BenchSampling.h) stands for `sampling` calls of the
+ * measured duration divided by `sampling`.
+ *
+ * @Note for internal nodes (`BenchBunch`), the elapsed time is computed from
+ *       the children when dumped, so only `count` and the dumped elapsed
+ *       time are meaningful.
+ */
+struct AggregatedBenchInfos {
+    static constexpr bool aggregated = true;
+
+    using Comment_t = Comment;
+    using Comments_t = Comments<AggregatedBenchInfos>;
+    using Metrics_t = Metrics<AggregatedBenchInfos>;
+
+    std::chrono::nanoseconds elapsed{};
+    const char* name = nullptr;
+    Comments_t comments;
+    Metrics_t metrics;
+    const char* file = nullptr;
+    unsigned line = 0;
+    Counters_t counters{};
+    Allocations_t allocations{};
+    CpuTime_t cpuTime{};
+    Overhead_t overhead{};
+    TraceStamp_t trace{};
+
+    AULong count = 0;
+    AULong sampling = 1; // Number of calls of a single sample
+    std::chrono::nanoseconds min{};
+    std::chrono::nanoseconds max{};
+    double mean = 0.;
+    double m2 = 0.;
+    std::unique_ptr<LatencyHistogram> histogram;
+
+    AggregatedBenchInfos() = default;
+
+    explicit AggregatedBenchInfos(const char* name_) : name(name_) {}
+
+    AggregatedBenchInfos(std::chrono::nanoseconds elapsed_, const char* name_,
+                         Comments_t comments_ = {})
+        : elapsed(elapsed_), name(name_), comments(std::move(comments_)) {}
+
+    CallSite key() const { return { name, file, line }; }
+
+    double stddev() const {
+        return count > 1 ? std::sqrt(m2 / (count - 1)) : 0.;
+    }
+
+    /**
+     * Start the statistics with the current elapsed time as first sample.
+     */
+    void firstSample() {
+        const std::chrono::nanoseconds call = elapsed / ALong(sampling);
+        count = sampling;
+        min = max = call;
+        mean = call.count();
+        m2 = 0.;
+        histogram = std::make_unique<LatencyHistogram>();
+        histogram->record(call.count(), sampling);
+    }
+
+    /**
+     * Merge `sample`, a single run of the same call site, into this node.
+     * Comments with an already known key are overridden.
+     */
+    void addSample(AggregatedBenchInfos&& sample) {
+        // A sampled call is weighted by its rate
+        const std::chrono::nanoseconds call = sample.elapsed / ALong(sample.sampling);
+        const double x = call.count();
+        const double w = sample.sampling;
+        count += sample.sampling;
+        const double delta = x - mean;
+        mean += delta * w / count;
+        m2 += w * delta * (x - mean);
+        min = std::min(min, call);
+        max = std::max(max, call);
+        elapsed += sample.elapsed;
+        counters += sample.counters;
+        allocations += sample.allocations;
+        cpuTime += sample.cpuTime;
+        overhead += sample.overhead;
+        addMetrics(metrics, sample.metrics);
+        histogram->record(call.count(), sample.sampling);
+
+        for (auto& comment : sample.comments) {
+            setComment(comment.key, std::move(comment.value));
+        }
+    }
+
+    /**
+     * Merge `o`, the statistics of the same call site gathered elsewhere (in
+     * another thread or before a flush), into this node.
+     */
+    void merge(const AggregatedBenchInfos& o) {
+        if (o.count == 0) {
+            return;
+        }
+
+        const double n = count + o.count;
+        const double delta = o.mean - mean;
+        m2 += o.m2 + delta * delta * count * o.count / n;
+        mean += delta * o.count / n;
+        min = count ? std::min(min, o.min) : o.min;
+        max = std::max(max, o.max);
+        count += o.count;
+        elapsed += o.elapsed;
+        counters += o.counters;
+        allocations += o.allocations;
+        cpuTime += o.cpuTime;
+        overhead += o.overhead;
+        addMetrics(metrics, o.metrics);
+
+        if (o.histogram) {
+            if (!histogram) {
+                histogram = std::make_unique<LatencyHistogram>();
+            }
+            histogram->merge(*o.histogram);
+        }
+
+        for (const auto& comment : o.comments) {
+            setComment(comment.key, CommentValue(comment.value));
+        }
+    }
+
+    /**
+     * Same as `BenchInfos::addComment` but override the value of an already
+     * known key, so that the comments stay bounded across merged samples.
+     */
+    template <std::size_t N, typename Value>
+    void addComment(const char (&key)[N], Value&& value) {
+        setComment(key, makeCommentValue(std::forward<Value>(value)));
+    }
+
+    /**
+     * Same as `BenchInfos::addCounter`, the metrics of the merged samples are
+     * summed.
+     */
+    template <std::size_t N, typename Value>
+    void addCounter(const char (&key)[N], Value value) {
+        addMetric(metrics, key, value);
+    }
+
+    void setComment(const char* key, CommentValue&& value) {
+        auto it = std::find_if(comments.begin(), comments.end(), [&](const auto& c) {
+            return c.key == key || std::strcmp(c.key, key) == 0;
+        });
+        if (it == comments.end()) {
+            comments.push_back({ key, std::move(value) });
         } else {
-            comments.emplace_back(std::forward<Key>(key),
-                                  std::forward<Value>(value));
+            it->value = std::move(value);
         }
     }
 };
 
+/**
+ * The comments and the metrics of a bench object live in the arena, which is
+ * pinned while the object holds some (see `Arena::pin`).
+ */
+template <typename Infos>
+FORCEINLINE bool holdsArena(const Infos& infos) {
+    return !infos.comments.empty() || !infos.metrics.empty();
+}
+
+template <typename Infos, typename = void>
+struct is_aggregated : std::false_type {};
+
+template <typename Infos>
+struct is_aggregated<Infos, std::void_t<decltype(Infos::aggregated)>>
+    : std::bool_constant<Infos::aggregated> {};
+
+template <typename Infos>
+inline constexpr bool is_aggregated_v = is_aggregated<Infos>::value;
+
+#ifndef ALGOLIA_PROFILING_AGGREGATE
+    #define ALGOLIA_PROFILING_AGGREGATE 0
+#endif
+
+/**
+ * Infos used by default by the bench objects. Setting ALGOLIA_PROFILING_AGGREGATE
+ * to 1 merges repeated scopes instead of adding a node per call.
+ */
+#if ALGOLIA_PROFILING_AGGREGATE == 1
+using DefaultBenchInfos = AggregatedBenchInfos;
+#else
+using DefaultBenchInfos = BenchInfos;
+#endif
+
 } // namespace bench
@@ -0,0 +1,405 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+#include "utils/bench/BenchClock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+namespace bench {
+
+// ----------------
+// Profiled mutexes
+// ----------------
+
+/**
+ * Totals of the locks sharing a name, see `LockRegistry::totals`.
+ */
+struct LockTotals {
+    const char* name;
+    AULong acquisitions = 0;
+    AULong contentions = 0; // Acquisitions which had to wait
+    std::chrono::nanoseconds wait{};
+    std::chrono::nanoseconds maxWait{};
+    std::chrono::nanoseconds hold{};
+
+    AULong sharedAcquisitions = 0;
+    AULong sharedContentions = 0;
+    std::chrono::nanoseconds sharedWait{};
+    std::chrono::nanoseconds sharedHold{};
+
+    LockTotals& operator+=(const LockTotals& o) {
+        acquisitions += o.acquisitions;
+        contentions += o.contentions;
+        wait += o.wait;
+        maxWait = std::max(maxWait, o.maxWait);
+        hold += o.hold;
+        sharedAcquisitions += o.sharedAcquisitions;
+        sharedContentions += o.sharedContentions;
+        sharedWait += o.sharedWait;
+        sharedHold += o.sharedHold;
+        return *this;
+    }
+};
+
+#if ALGOLIA_PROFILING == 1
+/**
+ * Statistics of a single profiled mutex, in nanoseconds.
+ *
+ * The exclusive ones are only written by the owner of the lock, so they are
+ * updated with relaxed loads and stores, which are plain moves: they are
+ * atomics only so that `LockRegistry` can read them at any time. The shared
+ * ones are written concurrently by the readers.
+ */
+struct LockStats {
+    explicit LockStats(const char* name_) : name(name_) {}
+
+    LockStats(const LockStats&) = delete;
+    LockStats& operator=(const LockStats&) = delete;
+
+    // Only called by the owner of the lock
+    static void add(std::atomic<AULong>& stat, AULong value) {
+        stat.store(stat.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    LockTotals read() const {
+        auto ns = [](const std::atomic<AULong>& stat) {
+            return std::chrono::nanoseconds(stat.load(std::memory_order_relaxed));
+        };
+        LockTotals ret{ name };
+        ret.acquisitions = acquisitions.load(std::memory_order_relaxed);
+        ret.contentions = contentions.load(std::memory_order_relaxed);
+        ret.wait = ns(wait);
+        ret.maxWait = ns(maxWait);
+        ret.hold = ns(hold);
+        ret.sharedAcquisitions = sharedAcquisitions.load(std::memory_order_relaxed);
+        ret.sharedContentions = sharedContentions.load(std::memory_order_relaxed);
+        ret.sharedWait = ns(sharedWait);
+        ret.sharedHold = ns(sharedHold);
+        return ret;
+    }
+
+    const char* name; // Literal, like the bench names
+    std::atomic<AULong> acquisitions = 0;
+    std::atomic<AULong> contentions = 0;
+    std::atomic<AULong> wait = 0;
+    std::atomic<AULong> maxWait = 0;
+    std::atomic<AULong> hold = 0;
+
+    std::atomic<AULong> sharedAcquisitions = 0;
+    std::atomic<AULong> sharedContentions = 0;
+    std::atomic<AULong> sharedWait = 0;
+    std::atomic<AULong> sharedHold = 0;
+};
+
+/**
+ * Every profiled mutex alive, and the totals of the destroyed ones. A mutex
+ * registers itself when built and folds its statistics in when destroyed,
+ * under a lock: only the creation and the destruction of the mutexes go
+ * through it, never their use.
+ */
+class LockRegistry {
+public:
+    static LockRegistry& instance() {
+        static LockRegistry registry;
+        return registry;
+    }
+
+    void add(const LockStats* stats) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _live.push_back(stats);
+    }
+
+    void remove(const LockStats* stats) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _live.erase(std::find(_live.begin(), _live.end(), stats));
+        accumulate(_retired, stats->read());
+    }
+
+    /**
+     * Statistics of the locks summed by name, in order of first creation.
+     * The ones of a mutex being held do not count its current hold yet.
+     */
+    std::vector<LockTotals> totals() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<LockTotals> ret = _retired;
+        for (const LockStats* stats : _live) {
+            accumulate(ret, stats->read());
+        }
+        return ret;
+    }
+
+    /**
+     * Write the totals as a JSON array of locks. The shared fields are only
+     * written for the locks which were shared.
+     */
+    void dump(JSONWriter& writer) const {
+        writer.pushArrayStart();
+        for (const auto& lock : totals()) {
+            writer.pushMapStart();
+            writer.pushMapKeyConst("name");
+            writer.pushString(lock.name);
+            writer.pushMapKeyConst("acquisitions");
+            writer.pushString(std::to_string(lock.acquisitions));
+            writer.pushMapKeyConst("contentions");
+            writer.pushString(std::to_string(lock.contentions));
+            writer.pushMapKeyConst("wait");
+            writer.pushString(prettyPrint(lock.wait.count()));
+            writer.pushMapKeyConst("max_wait");
+            writer.pushString(prettyPrint(lock.maxWait.count()));
+            writer.pushMapKeyConst("hold");
+            writer.pushString(prettyPrint(lock.hold.count()));
+            if (lock.sharedAcquisitions > 0) {
+                writer.pushMapKeyConst("shared_acquisitions");
+                writer.pushString(std::to_string(lock.sharedAcquisitions));
+                writer.pushMapKeyConst("shared_contentions");
+                writer.pushString(std::to_string(lock.sharedContentions));
+                writer.pushMapKeyConst("shared_wait");
+                writer.pushString(prettyPrint(lock.sharedWait.count()));
+                writer.pushMapKeyConst("shared_hold");
+                writer.pushString(prettyPrint(lock.sharedHold.count()));
+            }
+            writer.pushMapEnd();
+        }
+        writer.pushArrayEnd();
+    }
+
+private:
+    LockRegistry() = default;
+
+    // Names are compared by address first, like the call sites
+    static void accumulate(std::vector<LockTotals>& totals, const LockTotals& lock) {
+        auto it = std::find_if(totals.begin(), totals.end(), [&](const auto& t) {
+            return t.name == lock.name || std::strcmp(t.name, lock.name) == 0;
+        });
+        if (it == totals.end()) {
+            totals.push_back(lock);
+        } else {
+            *it += lock;
+        }
+    }
+
+    mutable std::mutex _mutex;
+    std::vector<const LockStats*> _live;
+    std::vector<LockTotals> _retired;
+};
+
+/**
+ * Drop-in replacement of `Mutex` recording, under the name given to it, the
+ * time spent waiting to acquire it, the time it is held and the number of
+ * contended acquisitions (see `LockRegistry` and `BenchEnv::flushLocks`).
+ *
+ * An acquisition first tries the lock: an uncontended one adds no atomic
+ * operation to the ones of `Mutex`, only two clock reads to measure the hold.
+ * The clock is only read for the wait when the try fails.
+ *
+ * @Example ```
+ *      static bench::ProfiledMutex mutex("cache");
+ *      std::lock_guard lock(mutex);
+ *          ```
+ */
+template <typename Mutex, typename Clock = DefaultBenchClock>
+class BasicProfiledMutex {
+public:
+    template <std::size_t N>
+    explicit BasicProfiledMutex(const char (&name)[N]) : _stats(name) {
+        LockRegistry::instance().add(&_stats);
+    }
+
+    ~BasicProfiledMutex() {
+        LockRegistry::instance().remove(&_stats);
+    }
+
+    BasicProfiledMutex(const BasicProfiledMutex&) = delete;
+    BasicProfiledMutex& operator=(const BasicProfiledMutex&) = delete;
+
+    void lock() {
+        if (__builtin_expect(!_mutex.try_lock(), 0)) {
+            const auto start = Clock::start();
+            _mutex.lock();
+            const AULong wait = Clock::elapsed(start, Clock::stop()).count();
+            LockStats::add(_stats.contentions, 1);
+            LockStats::add(_stats.wait, wait);
+            if (wait > _stats.maxWait.load(std::memory_order_relaxed)) {
+                _stats.maxWait.store(wait, std::memory_order_relaxed);
+            }
+        }
+        acquired();
+    }
+
+    bool try_lock() {
+        if (!_mutex.try_lock()) {
+            return false;
+        }
+        acquired();
+        return true;
+    }
+
+    void unlock() {
+        LockStats::add(_stats.hold, Clock::elapsed(_holdStart, Clock::stop()).count());
+        _mutex.unlock();
+    }
+
+protected:
+    void acquired() {
+        LockStats::add(_stats.acquisitions, 1);
+        _holdStart = Clock::start();
+    }
+
+    Mutex _mutex;
+    LockStats _stats;
+    typename Clock::tick_t _holdStart{}; // Written by the owner only
+};
+
+using ProfiledMutex = BasicProfiledMutex<std::mutex>;
+
+namespace details {
+    /**
+     * When the shared locks held by the thread were taken. A reader has no
+     * storage of its own in the mutex, so its start is kept here.
+     */
+    template <typename Clock>
+    struct SharedHolds {
+        static constexpr std::size_t capacity = 16;
+
+        struct Hold {
+            const void* mutex;
+            typename Clock::tick_t start;
+        };
+
+        void push(const void* mutex, typename Clock::tick_t start) {
+            if (size < capacity) {
+                holds[size] = { mutex, start };
+            }
+            ++size;
+        }
+
+        // Start of the last hold of `mutex`, false if it was not kept
+        bool pop(const void* mutex, typename Clock::tick_t& start) {
+            if (size == 0) {
+                return false;
+            }
+            const std::size_t kept = std::min(size, capacity);
+            --size;
+            for (std::size_t i = kept; i-- > 0;) {
+                if (holds[i].mutex == mutex) {
+                    start = holds[i].start;
+                    std::copy(holds + i + 1, holds + kept, holds + i);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        Hold holds[capacity];
+        std::size_t size = 0;
+    };
+
+    template <typename Clock>
+    inline thread_local SharedHolds<Clock> sharedHolds;
+} // namespace details
+
+/**
+ * Same as `ProfiledMutex` for a `std::shared_mutex`. The readers run
+ * concurrently, so a shared acquisition and its release each add an atomic
+ * increment of the statistics.
+ *
+ * @Note the hold of a shared lock is not measured when the thread holds more
+ *       than 16 shared profiled locks at once.
+ */
+template <typename Clock = DefaultBenchClock>
+class BasicProfiledSharedMutex : public BasicProfiledMutex<std::shared_mutex, Clock> {
+    using Base = BasicProfiledMutex<std::shared_mutex, Clock>;
+
+public:
+    using Base::Base;
+
+    void lock_shared() {
+        if (__builtin_expect(!this->_mutex.try_lock_shared(), 0)) {
+            const auto start = Clock::start();
+            this->_mutex.lock_shared();
+            const AULong wait = Clock::elapsed(start, Clock::stop()).count();
+            this->_stats.sharedContentions.fetch_add(1, std::memory_order_relaxed);
+            this->_stats.sharedWait.fetch_add(wait, std::memory_order_relaxed);
+        }
+        sharedAcquired();
+    }
+
+    bool try_lock_shared() {
+        if (!this->_mutex.try_lock_shared()) {
+            return false;
+        }
+        sharedAcquired();
+        return true;
+    }
+
+    void unlock_shared() {
+        typename Clock::tick_t start;
+        if (details::sharedHolds<Clock>.pop(this, start)) {
+            const AULong hold = Clock::elapsed(start, Clock::stop()).count();
+            this->_stats.sharedHold.fetch_add(hold, std::memory_order_relaxed);
+        }
+        this->_mutex.unlock_shared();
+    }
+
+private:
+    void sharedAcquired() {
+        this->_stats.sharedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+        details::sharedHolds<Clock>.push(this, Clock::start());
+    }
+};
+
+using ProfiledSharedMutex = BasicProfiledSharedMutex<>;
+
+#else
+class LockRegistry {
+public:
+    static LockRegistry& instance() {
+        static LockRegistry registry;
+        return registry;
+    }
+
+    std::vector<LockTotals> totals() const { return {}; }
+    void dump(JSONWriter&) const {}
+};
+
+template <typename Mutex, typename Clock = DefaultBenchClock>
+class BasicProfiledMutex {
+public:
+    template <std::size_t N>
+    explicit BasicProfiledMutex(const char (&)[N]) {}
+
+    BasicProfiledMutex(const BasicProfiledMutex&) = delete;
+    BasicProfiledMutex& operator=(const BasicProfiledMutex&) = delete;
+
+    void lock() { _mutex.lock(); }
+    bool try_lock() { return _mutex.try_lock(); }
+    void unlock() { _mutex.unlock(); }
+
+protected:
+    Mutex _mutex;
+};
+
+using ProfiledMutex = BasicProfiledMutex<std::mutex>;
+
+template <typename Clock = DefaultBenchClock>
+class BasicProfiledSharedMutex : public BasicProfiledMutex<std::shared_mutex, Clock> {
+    using Base = BasicProfiledMutex<std::shared_mutex, Clock>;
+
+public:
+    using Base::Base;
+
+    void lock_shared() { this->_mutex.lock_shared(); }
+    bool try_lock_shared() { return this->_mutex.try_lock_shared(); }
+    void unlock_shared() { this->_mutex.unlock_shared(); }
+};
+
+using ProfiledSharedMutex = BasicProfiledSharedMutex<>;
+#endif
+
+} // namespace bench
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/bench/BenchInfos.h"
+#include "utils/bench/BenchOverhead.h"
+#include "utils/bench/BenchTree.h"
+
+namespace bench {
+
+// -------------
+// Merged trees
+// -------------
+
+/**
+ * Trees of several threads combined by call path: the nodes having the same
+ * names from the top of their tree are merged into one, holding their total
+ * and how it was spread over the threads (min and max thread, imbalance).
+ *
+ * Each node of a thread is merged in O(1) through a hash of its parent in the
+ * profile and its name, so merging is linear in the total number of nodes.
+ *
+ * @Note names are compared by address, like the call sites.
+ */
+class MergedProfile {
+public:
+    static constexpr AUInt npos = ~AUInt(0);
+
+    struct Node {
+        const char* name;
+        AUInt parent;
+        bool internal;
+        AUInt firstChild = npos;
+        AUInt lastChild = npos;
+        AUInt next = npos; // Next sibling
+
+        Inclusive total{}; // Summed over the threads
+        AULong calls = 0;
+        AUInt threads = 0; // Threads which ran it
+        std::chrono::nanoseconds minElapsed{};
+        std::chrono::nanoseconds maxElapsed{};
+        AUInt minThread = npos;
+        AUInt maxThread = npos;
+
+        // Time of the thread being merged
+        AUInt thread = npos;
+        std::chrono::nanoseconds threadElapsed{};
+
+        // Max thread time over the mean thread time
+        double imbalance() const {
+            return total.elapsed.count() > 0
+                ? double(maxElapsed.count()) * threads / total.elapsed.count() : 1.;
+        }
+    };
+
+    /**
+     * Merge `tree`, the one of the thread named `threadId`. Every tree must
+     * come from a different thread.
+     */
+    template <class Infos>
+    void add(const Tree<Infos>& tree, std::string threadId);
+
+    /**
+     * Write the profile as a JSON array of top level nodes.
+     */
+    void dump(JSONWriter& writer, const OverheadCalibration& calibration = {}) {
+        foldThreads();
+        writer.pushArrayStart();
+        for (AUInt i = _top; i != npos; i = _nodes[i].next) {
+            dumpNode(writer, calibration, i);
+        }
+        writer.pushArrayEnd();
+    }
+
+    void clear() {
+        _nodes.clear();
+        _index.clear();
+        _threads.clear();
+        _top = _lastTop = npos;
+    }
+
+    bool empty() const { return _threads.empty(); }
+    const std::vector<Node>& nodes() const { return _nodes; }
+    const std::vector<std::string>& threads() const { return _threads; }
+
+    /**
+     * Node `name` under `parent` (npos for the top level), created if needed.
+     * Its time is accounted for `thread`.
+     */
+    AUInt enter(AUInt parent, const char* name, bool internal, AUInt thread) {
+        const auto [it, inserted] = _index.try_emplace({ parent, name, internal }, AUInt(_nodes.size()));
+        if (inserted) {
+            _nodes.push_back(Node{ name, parent, internal });
+            AUInt& last = parent == npos ? _lastTop : _nodes[parent].lastChild;
+            AUInt& first = parent == npos ? _top : _nodes[parent].firstChild;
+            (last == npos ? first : _nodes[last].next) = it->second;
+            last = it->second;
+        }
+
+        Node& node = _nodes[it->second];
+        if (node.thread != thread) {
+            fold(node);
+            node.thread = thread;
+        }
+        return it->second;
+    }
+
+    void account(AUInt i, const Inclusive& values, AULong calls) {
+        Node& node = _nodes[i];
+        node.total += values;
+        node.calls += calls;
+        node.threadElapsed += values.elapsed;
+    }
+
+private:
+    struct Key {
+        AUInt parent;
+        const char* name;
+        bool internal;
+
+        bool operator==(const Key& o) const {
+            return parent == o.parent && name == o.name && internal == o.internal;
+        }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& k) const {
+            std::size_t h = std::hash<const void*>{}(k.name);
+            h ^= std::hash<AUInt>{}(k.parent) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h ^ k.internal;
+        }
+    };
+
+    // Account the time of the thread last merged into `node`
+    static void fold(Node& node) {
+        if (node.thread == npos) {
+            return;
+        }
+        const auto elapsed = node.threadElapsed;
+        if (node.threads == 0 || elapsed < node.minElapsed) {
+            node.minElapsed = elapsed;
+            node.minThread = node.thread;
+        }
+        if (node.threads == 0 || elapsed > node.maxElapsed) {
+            node.maxElapsed = elapsed;
+            node.maxThread = node.thread;
+        }
+        ++node.threads;
+        node.thread = npos;
+        node.threadElapsed = {};
+    }
+
+    void foldThreads() {
+        for (auto& node : _nodes) {
+            fold(node);
+        }
+    }
+
+    void dumpNode(JSONWriter& writer, const OverheadCalibration& calibration, AUInt i) const {
+        const Node& node = _nodes[i];
+        writer.pushMapStart();
+        writer.pushMapKeyConst("name");
+        writer.pushString(node.name);
+        writer.pushMapKeyConst("elapsed");
+        writer.pushString(prettyPrint(node.total.elapsed.count()));
+        if constexpr (std::is_same_v<Overhead_t, Overhead>) {
+            writer.pushMapKeyConst("corrected");
+            writer.pushString(prettyPrint(calibration.correct(node.total.elapsed, node.total.overhead).count()));
+        }
+        writer.pushMapKeyConst("calls");
+        writer.pushString(std::to_string(node.calls));
+        writer.pushMapKeyConst("threads");
+        writer.pushString(std::to_string(node.threads));
+        writer.pushMapKeyConst("min");
+        writer.pushString(prettyPrint(node.minElapsed.count()));
+        writer.pushMapKeyConst("min_thread");
+        writer.pushString(_threads[node.minThread]);
+        writer.pushMapKeyConst("max");
+        writer.pushString(prettyPrint(node.maxElapsed.count()));
+        writer.pushMapKeyConst("max_thread");
+        writer.pushString(_threads[node.maxThread]);
+
+        char imbalance[32];
+        snprintf(imbalance, sizeof(imbalance), "%.2f", node.imbalance());
+        writer.pushMapKeyConst("imbalance");
+        writer.pushString(imbalance);
+
+        if (node.internal) {
+            writer.pushMapKeyConst("sub");
+            writer.pushArrayStart();
+            for (AUInt c = node.firstChild; c != npos; c = _nodes[c].next) {
+                dumpNode(writer, calibration, c);
+            }
+            writer.pushArrayEnd();
+        }
+        writer.pushMapEnd();
+    }
+
+    std::vector<Node> _nodes;
+    std::unordered_map<Key, AUInt, KeyHash> _index;
+    std::vector<std::string> _threads;
+    AUInt _top = npos; // First top level node
+    AUInt _lastTop = npos;
+};
+
+/**
+ * Merge the nodes of a thread tree into a `MergedProfile`.
+ */
+template <class Infos>
+struct MergeVisitor : public Tree<Infos>::template Visitor<MergeVisitor<Infos>> {
+    using Node = typename Tree<Infos>::Node;
+    using InternalNode = typename Tree<Infos>::InternalNode;
+
+    MergeVisitor(MergedProfile& profile_, AUInt thread_)
+        : profile(profile_), thread(thread_) {}
+
+    void visit(const Node& n) {
+        const AUInt i = profile.enter(parent, n.value.name, false, thread);
+        profile.account(i, Inclusive::of(n.value), calls(n.value));
+    }
+
+    void visit(const InternalNode& n) {
+        const AUInt i = profile.enter(parent, n.value.name, true, thread);
+        profile.account(i, inclusive.next(n), calls(n.value));
+
+        const AUInt father = parent;
+        parent = i;
+        n.children.foreach([&](auto&& child) {
+            child.accept(*this);
+        });
+        parent = father;
+    }
+
+    static AULong calls(const Infos& infos) {
+        if constexpr (is_aggregated_v<Infos>) {
+            return infos.count;
+        } else {
+            return 1;
+        }
+    }
+
+    MergedProfile& profile;
+    const AUInt thread;
+    AUInt parent = MergedProfile::npos;
+    InclusiveValues<Infos> inclusive;
+};
+
+template <class Infos>
+void MergedProfile::add(const Tree<Infos>& tree, std::string threadId) {
+    _threads.push_back(std::move(threadId));
+    MergeVisitor<Infos> v{ *this, AUInt(_threads.size() - 1) };
+    tree.accept(v);
+}
+
+} // namespace bench
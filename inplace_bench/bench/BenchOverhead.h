@@ -0,0 +1,156 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace bench {
+
+#ifndef ALGOLIA_PROFILING_CORRECTION
+    #define ALGOLIA_PROFILING_CORRECTION 1
+#endif
+
+// ---------------------------
+// Instrumentation overhead
+// ---------------------------
+
+/**
+ * What the bench objects added to an elapsed time: the number of measures
+ * (clock read pairs) it is made of, and the number of bench objects recorded
+ * during those measures. Summed into the parents like the elapsed time, it
+ * gives the "corrected" time of the dumps (see `OverheadCalibration`).
+ *
+ * `nestedTime` is the time measured by the bench objects recorded during the
+ * measures. A scope nested in another one is recorded as its sibling, the
+ * elapsed time minus `nestedTime` is the self time of the outer one.
+ */
+struct Overhead {
+    AULong timers = 0;
+    AULong nested = 0;
+    std::chrono::nanoseconds nestedTime{};
+
+    Overhead& operator+=(const Overhead& o) {
+        timers += o.timers;
+        nested += o.nested;
+        nestedTime += o.nestedTime;
+        return *this;
+    }
+
+    Overhead& operator*=(AULong factor) {
+        timers *= factor;
+        nested *= factor;
+        nestedTime *= ALong(factor);
+        return *this;
+    }
+};
+
+/**
+ * Placeholder used instead of `Overhead` when ALGOLIA_PROFILING_CORRECTION is
+ * disabled, so that the infos do not grow.
+ */
+struct NoOverhead {
+    NoOverhead& operator+=(const NoOverhead&) { return *this; }
+    NoOverhead& operator*=(AULong) { return *this; }
+};
+
+#if ALGOLIA_PROFILING_CORRECTION == 1
+using Overhead_t = Overhead;
+#else
+using Overhead_t = NoOverhead;
+#endif
+
+// Number of bench objects recorded by the thread, a bench object counts the
+// ones recorded while it measures
+inline thread_local AULong nbRecordedBenches = 0;
+
+// Called by the environment for each bench object added to the tree
+FORCEINLINE void countRecorded() {
+#if ALGOLIA_PROFILING_CORRECTION == 1
+    ++nbRecordedBenches;
+#endif
+}
+
+/**
+ * Account for a measure started when the thread had recorded
+ * `recordedAtStart` bench objects.
+ */
+FORCEINLINE void countMeasure(Overhead& overhead, AULong recordedAtStart) {
+    ++overhead.timers;
+    overhead.nested += nbRecordedBenches - recordedAtStart;
+}
+
+FORCEINLINE void countMeasure(NoOverhead&, AULong) {}
+
+// Time measured by the bench objects recorded by the thread, the ones nested
+// in another bench object excepted
+inline thread_local std::chrono::nanoseconds recordedTime{};
+
+/**
+ * Account for the time of the bench objects recorded during the measures of a
+ * bench started when the thread had recorded `recordedTimeAtStart`. The
+ * `measured` time of the bench then replaces theirs for the benches enclosing
+ * it, since it includes them.
+ *
+ * @Note called once the measures of the bench are done, before a sampled
+ *       bench is scaled.
+ */
+FORCEINLINE void countNestedTime(Overhead& overhead, std::chrono::nanoseconds recordedTimeAtStart,
+                                 std::chrono::nanoseconds measured) {
+    overhead.nestedTime += recordedTime - recordedTimeAtStart;
+    recordedTime = recordedTimeAtStart + measured;
+}
+
+FORCEINLINE void countNestedTime(NoOverhead&, std::chrono::nanoseconds, std::chrono::nanoseconds) {}
+
+/**
+ * Same as `countMeasure` and `countNestedTime` for a measure lasting as long
+ * as this object, added to `elapsed` by a timer destroyed before it.
+ */
+struct ScopedOverhead {
+    ScopedOverhead(Overhead_t& acc_, const std::chrono::nanoseconds& elapsed_)
+        : acc(acc_), elapsed(elapsed_), recordedAtStart(nbRecordedBenches),
+          recordedTimeAtStart(recordedTime), elapsedAtStart(elapsed_) {}
+
+    FORCEINLINE ~ScopedOverhead() {
+        countMeasure(acc, recordedAtStart);
+        countNestedTime(acc, recordedTimeAtStart, elapsed - elapsedAtStart);
+    }
+
+    ScopedOverhead(const ScopedOverhead&) = delete;
+    ScopedOverhead(ScopedOverhead&&) = delete;
+    ScopedOverhead& operator=(const ScopedOverhead&) = delete;
+    ScopedOverhead& operator=(ScopedOverhead&&) = delete;
+
+    Overhead_t& acc;
+    const std::chrono::nanoseconds& elapsed;
+    AULong recordedAtStart;
+    std::chrono::nanoseconds recordedTimeAtStart;
+    std::chrono::nanoseconds elapsedAtStart;
+};
+
+/**
+ * Cost of the instrumentation, measured once on the first dump (see
+ * `overheadCalibration` in BenchEnv.h):
+ * - `timer`: time seen by a measure of nothing, the clock reads themselves,
+ * - `nested`: time an empty bench object adds to the measure enclosing it.
+ */
+struct OverheadCalibration {
+    double timer = 0.;
+    double nested = 0.;
+
+    std::chrono::nanoseconds correct(std::chrono::nanoseconds elapsed,
+                                     const Overhead& overhead) const {
+        const double corrected = elapsed.count() - timer * overhead.timers
+                                 - nested * overhead.nested;
+        return std::chrono::nanoseconds(ALong(std::max(corrected, 0.)));
+    }
+
+    // Nothing is counted when ALGOLIA_PROFILING_CORRECTION is disabled
+    std::chrono::nanoseconds correct(std::chrono::nanoseconds elapsed,
+                                     const NoOverhead&) const {
+        return elapsed;
+    }
+};
+
+} // namespace bench
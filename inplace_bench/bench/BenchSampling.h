@@ -0,0 +1,72 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+#include "utils/bench/BenchInfos.h"
+
+namespace bench {
+
+// --------
+// Sampling
+// --------
+
+/**
+ * Count the executions of a call site and select one of every `rate` of them.
+ * A not selected execution only decrements the counter.
+ *
+ * The constructor being constexpr, a `static thread_local` sampler with a
+ * constant rate is initialized without any guard (see BENCH_SAMPLED_SCOPE).
+ *
+ * @Note the selection is periodic: a call site whose cost follows a period
+ *       sharing a factor with `rate` gives a biased estimate.
+ */
+class Sampler {
+public:
+    constexpr explicit Sampler(AULong rate)
+        : _rate(rate ? rate : 1), _countdown(_rate) {}
+
+    /**
+     * @return the rate when this execution is selected, 0 otherwise.
+     */
+    FORCEINLINE AULong tick() {
+        if (--_countdown != 0) {
+            return 0;
+        }
+        _countdown = _rate;
+        return _rate;
+    }
+
+    AULong rate() const { return _rate; }
+
+private:
+    AULong _rate;
+    AULong _countdown;
+};
+
+/**
+ * Tag given to `BenchScope` when it measures one execution out of `rate`.
+ */
+struct Sampled {
+    AULong rate;
+};
+
+/**
+ * Turn the measure of a selected execution into an estimate of the `rate`
+ * executions it stands for. The node is flagged with a "sampling" comment.
+ */
+template <typename Infos>
+void scaleSample(Infos& infos, AULong rate) {
+    infos.elapsed *= ALong(rate);
+    infos.counters *= rate;
+    infos.allocations *= rate;
+    infos.cpuTime *= rate;
+    infos.overhead *= rate;
+    for (auto& metric : infos.metrics) {
+        metric.scale(rate);
+    }
+    if constexpr (is_aggregated_v<Infos>) {
+        infos.sampling = rate;
+    }
+    infos.addComment("sampling", rate);
+}
+
+} // namespace bench
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+namespace bench {
+
+#ifndef ALGOLIA_PROFILING_RUNTIME
+    #define ALGOLIA_PROFILING_RUNTIME 0
+#endif
+
+// ----------------
+// Runtime switches
+// ----------------
+
+/**
+ * When ALGOLIA_PROFILING_RUNTIME is set to 1 (on top of ALGOLIA_PROFILING),
+ * the bench objects check at construction whether their category is enabled
+ * and do nothing otherwise. A disabled bench then costs a relaxed load and a
+ * branch, which makes it possible to ship the profiling in production and to
+ * enable it on a live process.
+ *
+ * The categories are bits of a mask, a bench object belongs to
+ * `category::main` unless told otherwise. Everything is disabled at startup,
+ * unless the environment variable ALGOLIA_PROFILING_ENABLE is set to "all" or
+ * to a mask of categories (e.g. "0x5").
+ */
+using Category = AULong;
+
+namespace category {
+    inline constexpr Category main = 1;
+    inline constexpr Category all = ~Category(0);
+} // namespace category
+
+namespace details {
+    [[maybe_unused]] static Category readEnabledCategories() {
+        const char* env = getenv("ALGOLIA_PROFILING_ENABLE");
+        if (!env) {
+            return 0;
+        }
+        if (strcmp(env, "all") == 0) {
+            return category::all;
+        }
+        return strtoull(env, nullptr, 0);
+    }
+
+    inline std::atomic<Category> enabledCategories{readEnabledCategories()};
+    // Categories enabled again by `toggleProfiling`
+    inline std::atomic<Category> toggledCategories{category::all};
+} // namespace details
+
+FORCEINLINE bool isProfilingEnabled(Category c = category::main) {
+#if ALGOLIA_PROFILING_RUNTIME == 1
+    return details::enabledCategories.load(std::memory_order_relaxed) & c;
+#else
+    (void)c;
+    return true;
+#endif
+}
+
+static inline void enableProfiling(Category c = category::all) {
+    details::enabledCategories.fetch_or(c, std::memory_order_relaxed);
+}
+
+static inline void disableProfiling(Category c = category::all) {
+    details::enabledCategories.fetch_and(~c, std::memory_order_relaxed);
+}
+
+/**
+ * Disable every category if one is enabled, otherwise enable back the
+ * categories which were enabled before the last toggle.
+ *
+ * @Note async-signal-safe.
+ */
+static inline void toggleProfiling() {
+    const Category enabled = details::enabledCategories.load(std::memory_order_relaxed);
+    if (enabled) {
+        details::toggledCategories.store(enabled, std::memory_order_relaxed);
+        details::enabledCategories.store(0, std::memory_order_relaxed);
+    } else {
+        details::enabledCategories.store(
+            details::toggledCategories.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Call `toggleProfiling` each time the process receives `sig`
+ * (e.g. `kill -USR2 <pid>`).
+ *
+ * @return false if the handler could not be installed.
+ */
+static inline bool installProfilingSignal(int sig = SIGUSR2) {
+    static_assert(std::atomic<Category>::is_always_lock_free,
+                  "The signal handler needs lock-free atomics");
+    struct sigaction action {};
+    action.sa_handler = [](int) { toggleProfiling(); };
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(sig, &action, nullptr) == 0;
+}
+
+} // namespace bench
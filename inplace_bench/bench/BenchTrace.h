@@ -0,0 +1,114 @@
+#pragma once
+
+#include "utils/bench/BenchUtils.h"
+#include "utils/bench/BenchClock.h"
+
+#include <stdio.h>
+
+#include <array>
+#include <string>
+
+namespace bench {
+
+#ifndef ALGOLIA_PROFILING_TRACE
+    #define ALGOLIA_PROFILING_TRACE 0
+#endif
+
+// Number of events kept per thread, the oldest ones are overridden
+#ifndef ALGOLIA_PROFILING_TRACE_EVENTS
+    #define ALGOLIA_PROFILING_TRACE_EVENTS (1 << 16)
+#endif
+
+// ------------
+// Trace events
+// ------------
+
+/**
+ * Start of a bench, stored in the infos when ALGOLIA_PROFILING_TRACE is
+ * enabled. The name is kept as the literal given to the bench object so that
+ * the event does not depend on the node storage.
+ */
+struct TraceStamp {
+    const char* name = nullptr;
+    AULong start = 0; // In nanoseconds, see `Clock::timestamp`
+    AULong duration = 0; // Measured, unlike the elapsed time of a sampled bench
+};
+
+struct NoTraceStamp {};
+
+#if ALGOLIA_PROFILING_TRACE == 1
+using TraceStamp_t = TraceStamp;
+#else
+using TraceStamp_t = NoTraceStamp;
+#endif
+
+struct TraceEvent {
+    const char* name;
+    AULong start;
+    AULong duration;
+};
+
+/**
+ * Fixed size ring of the last events of a thread.
+ */
+class TraceBuffer {
+public:
+    static constexpr std::size_t capacity = ALGOLIA_PROFILING_TRACE_EVENTS;
+
+    FORCEINLINE void add(const TraceEvent& event) {
+        _events[_pos] = event;
+        _pos = (_pos + 1) % capacity;
+        _size += _size < capacity;
+    }
+
+    /**
+     * Call `fn` on every event kept, from the oldest to the newest.
+     */
+    template <typename Func>
+    void foreach(Func fn) const {
+        const std::size_t first = (_pos + capacity - _size) % capacity;
+        for (std::size_t i = 0; i < _size; ++i) {
+            fn(_events[(first + i) % capacity]);
+        }
+    }
+
+    void clear() { _size = 0; }
+    std::size_t size() const { return _size; }
+
+private:
+    std::array<TraceEvent, capacity> _events;
+    std::size_t _pos = 0;
+    std::size_t _size = 0;
+};
+
+// Timestamps are written relative to the start of the process. Every clock
+// gives them on the timeline of steady_clock, which is read without calibration
+inline const AULong traceOrigin = SteadyClock::timestamp(SteadyClock::start());
+
+static constexpr char chromeTraceHeader[] = "{\"traceEvents\":[";
+static constexpr char chromeTraceFooter[] = "]}\n";
+
+/**
+ * Append `event` to `out` as a Chrome Trace Event "complete" event. The
+ * timestamps are written in microseconds as expected by chrome://tracing and
+ * Perfetto.
+ */
+static inline void pushChromeTraceEvent(std::string& out, const TraceEvent& event,
+                                        AULong tid) {
+    char buff[128];
+    out.append(out.back() == '[' ? "{\"name\":\"" : ",\n{\"name\":\"");
+    for (const char* c = event.name; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out.push_back('\\');
+        }
+        out.push_back(*c);
+    }
+    const int n = snprintf(buff, sizeof(buff),
+                           "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%llu}",
+                           (double(event.start) - double(traceOrigin)) / 1000.,
+                           event.duration / 1000.,
+                           static_cast<unsigned long long>(tid));
+    out.append(buff, n);
+}
+
+} // namespace bench
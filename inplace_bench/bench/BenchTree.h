@@ -1,39 +1,94 @@
 #pragma once
 
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
-#include "utils/varvector.h"
+#include "utils/bench/BenchArena.h"
+#include "utils/bench/BenchInfos.h"
 
 namespace bench {
 
+/**
+ * Values of a node including its subtree. Only the leaves are measured, the
+ * internal nodes add up their children when the tree is dumped (see
+ * `InclusiveValues`) so that recording a bench does not walk its ancestors.
+ */
+struct Inclusive {
+    std::chrono::nanoseconds elapsed{};
+    Counters_t counters{};
+    Allocations_t allocations{};
+    CpuTime_t cpuTime{};
+    Overhead_t overhead{};
+
+    template <typename Infos>
+    static Inclusive of(const Infos& infos) {
+        return { infos.elapsed, infos.counters, infos.allocations, infos.cpuTime, infos.overhead };
+    }
+
+    Inclusive& operator+=(const Inclusive& o) {
+        elapsed += o.elapsed;
+        counters += o.counters;
+        allocations += o.allocations;
+        cpuTime += o.cpuTime;
+        overhead += o.overhead;
+        return *this;
+    }
+};
+
 template <class T>
 class Tree {
 
 struct InternalNode; 
 struct Node;
+struct NodeBase;
+struct Children;
 
 template <class U>
 friend class DumpVisitor;
+template <class U>
+friend class BinaryDumpVisitor;
+template <class U>
+friend class InclusiveValues;
+template <class U>
+friend class MergeVisitor;
+template <class U>
+friend class FoldedStackVisitor;
 
 public:
     using ProcessFunc = std::function<void(const T&)>;
+    // Children of a node, see `detachRoot`
+    using Subtrees = Children;
 
-    Tree() : _root(new InternalNode()) { _tail = _root; }
+    /**
+     * @Note the nodes are allocated in the arena of the calling thread for
+     *       `T`, the tree has to be filled and destroyed by the same thread.
+     */
+    Tree() : _root(new InternalNode()) {
+        localArena<T>(); // Created first, so that it is destroyed after the tree
+        _tail = _root;
+    }
     ~Tree() { delete _root; }
 
-    Tree(Tree&&) = default;
-    Tree& operator=(Tree&&) = default;
-    Tree(const Tree&) = default;
-    Tree& operator=(const Tree&) = default;
+    Tree(const Tree&) = delete;
+    Tree& operator=(const Tree&) = delete;
 
     // -----------------
     // Modifiers methods
     // -----------------
     template <typename... Args> // Supports both emplace and move constructor
     T& addInternal(Args&&... args) {
-        _tail->children.template emplace_back<InternalNode>(_tail, std::forward<Args>(args)...);
-        _tail = &(_tail->children.template back<InternalNode>());
+        auto* internal = localArena<T>().template create<InternalNode>(_tail, std::forward<Args>(args)...);
+        _tail->children.push(internal);
+        _tail = internal;
 
         ++_size;
         return _tail->value;
@@ -41,14 +96,71 @@ public:
 
     template <typename... Args> // Supports both emplace and move constructor
     T& addLeaf(Args&&... args) {
-        _tail->children.template emplace_back<Node>(_tail, std::forward<Args>(args)...);
+        auto* leaf = localArena<T>().template create<Node>(_tail, std::forward<Args>(args)...);
+        _tail->children.push(leaf);
 
         ++_size;
-        return _tail->children.template back<Node>().value;
+        return leaf->value;
+    }
+
+    /**
+     * Same as `addLeaf` but merge `infos` into the sibling created from the
+     * same call site, if any.
+     *
+     * @Note only available for aggregated infos (see `AggregatedBenchInfos`).
+     */
+    T& mergeLeaf(T&& infos) {
+        auto& index = _tail->childIndex;
+        const auto it = index.find(infos.key());
+        if (it != index.end() && !it->second->internal) {
+            auto& leaf = static_cast<Node&>(*it->second);
+            leaf.value.addSample(std::forward<T>(infos));
+            return leaf.value;
+        }
+
+        T& ret = addLeaf(std::forward<T>(infos));
+        index.emplace(ret.key(), _tail->children.last);
+        ret.firstSample();
+        return ret;
+    }
+
+    /**
+     * Same as `addInternal` but go down into the sibling created from the
+     * same call site, if any, after merging `infos` into it.
+     *
+     * @Note only available for aggregated infos (see `AggregatedBenchInfos`).
+     */
+    T& mergeInternal(T&& infos) {
+        auto& index = _tail->childIndex;
+        const auto it = index.find(infos.key());
+        if (it != index.end() && it->second->internal) {
+            auto& internal = static_cast<InternalNode&>(*it->second);
+            internal.value.addSample(std::forward<T>(infos));
+            _tail = &internal;
+            return _tail->value;
+        }
+
+        InternalNode* father = _tail;
+        T& ret = addInternal(std::forward<T>(infos));
+        father->childIndex.emplace(ret.key(), _tail);
+        ret.firstSample();
+        return ret;
     }
 
     void goUp() { assert(_tail->father); _tail = _tail->father; }
 
+    /**
+     * Give away the subtrees under the root. They are all complete when the
+     * tail is the root.
+     */
+    auto detachRoot() {
+        assert(isRoot());
+        if constexpr (is_aggregated_v<T>) {
+            _root->childIndex.clear();
+        }
+        return std::move(_root->children);
+    }
+
     // ---------
     // Accessors
     // ---------
@@ -75,87 +187,188 @@ public:
 
     template <typename V>
     void accept(V&& v) const { 
-        _root->children.foreach([&v](auto&& child) {
+        accept(_root->children, std::forward<V>(v));
+    }
+
+    template <typename V>
+    static void accept(const Subtrees& subtrees, V&& v) {
+        subtrees.foreach([&v](auto&& child) {
             child.accept(std::forward<V>(v));
         });
     }
 
+    /**
+     * Compute the inclusive values of `n` and of the internal nodes under it
+     * in a single post-order pass. They are appended to `out` in pre-order,
+     * the order in which the visitors meet the internal nodes.
+     */
+    static Inclusive computeInclusive(const InternalNode& n, std::vector<Inclusive>& out) {
+        const std::size_t index = out.size();
+        out.emplace_back();
+
+        Inclusive ret = Inclusive::of(n.value);
+        n.children.foreach([&](auto&& child) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(child)>, InternalNode>) {
+                ret += computeInclusive(child, out);
+            } else {
+                ret += Inclusive::of(child.value);
+            }
+        });
+        out[index] = ret;
+        return ret;
+    }
+
 private:
-    struct Node {
+    struct NoIndex {};
+    using ChildIndex = std::conditional_t<is_aggregated_v<T>,
+        std::unordered_map<CallSite, NodeBase*, CallSiteHash>, NoIndex>;
+
+    struct NodeBase {
+        InternalNode* father;
+        NodeBase* next = nullptr; // Next sibling
+        const bool internal;
+    };
+
+    /**
+     * Children of an internal node, linked in insertion order.
+     */
+    struct Children {
+        Children() = default;
+        Children(Children&& o)
+            : first(o.first), last(o.last), count(o.count) {
+            o.first = o.last = nullptr;
+            o.count = 0;
+        }
+        Children(const Children&) = delete;
+        Children& operator=(const Children&) = delete;
+
+        void push(NodeBase* node) {
+            (last ? last->next : first) = node;
+            last = node;
+            ++count;
+        }
+
+        template <typename Func>
+        void foreach(Func fn) const {
+            for (const NodeBase* n = first; n; n = n->next) {
+                if (n->internal) {
+                    fn(static_cast<const InternalNode&>(*n));
+                } else {
+                    fn(static_cast<const Node&>(*n));
+                }
+            }
+        }
+
+        std::size_t size() const { return count; }
+
+        // The nodes live in the arena, only their destructor is called
+        ~Children() {
+            for (NodeBase* n = first; n;) {
+                NodeBase* next = n->next;
+                if (n->internal) {
+                    static_cast<InternalNode*>(n)->~InternalNode();
+                } else {
+                    static_cast<Node*>(n)->~Node();
+                }
+                n = next;
+            }
+        }
+
+        NodeBase* first = nullptr;
+        NodeBase* last = nullptr;
+        std::size_t count = 0;
+    };
+
+    struct Node : NodeBase {
         Node(InternalNode* father_, T&& infos)
-            : father(father_), value(std::forward<T>(infos)) {}
+            : NodeBase{father_, nullptr, false}, value(std::forward<T>(infos)) {}
 
         template <typename... Args>
         Node(InternalNode* father_, Args&&... args) // Emplace constructor
-            : father(father_), value{std::forward<Args>(args)...} {}
+            : NodeBase{father_, nullptr, false}, value{std::forward<Args>(args)...} {}
 
         template <typename V>
         void accept(V&& v) const {  v.visit(*this); }
 
-        InternalNode* father;
         T value;
     };
 
-    struct InternalNode {
+    struct InternalNode : NodeBase {
         template <typename... Args>
         InternalNode(InternalNode* father_, Args&&... args) // Emplace constructor
-            : father(father_), value{std::forward<Args>(args)...} {}
+            : NodeBase{father_, nullptr, true}, value{std::forward<Args>(args)...} {}
 
-        InternalNode() = default; // Root constructor
+        InternalNode() : NodeBase{nullptr, nullptr, true}, value{} {} // Root constructor
 
         template <typename V>
         void accept(V&& v) const {  v.visit(*this); }
 
-        InternalNode* father = nullptr;
         T value;
-        stable_varvector<Node, InternalNode> children;
+        Children children;
+        // First child of each call site
+        ChildIndex childIndex;
     };
 
     /**
-     * @Note By definition, a node can only be added to the tail's children.
-     *       Therefore, the children of the tail's father cannot be resized and
-     *       it is safe to store the tail as a pointer.
+     * @Note the nodes are never moved once allocated, so it is safe to store
+     *       the tail and the call site index as pointers.
      */
     InternalNode* _root; // Sentinel
     InternalNode* _tail;
-    AUInt _size;
+    AUInt _size = 0;
 };
 
 // -------------
 // Tree visitors
 // -------------
+
+/**
+ * Inclusive values of the internal nodes met by a visitor, in pre-order. The
+ * ones of a whole subtree are computed when its top internal node is met.
+ */
+template <class Infos>
+class InclusiveValues {
+public:
+    using InternalNode = typename Tree<Infos>::InternalNode;
+
+    const Inclusive& next(const InternalNode& n) {
+        if (_next == _values.size()) {
+            _values.clear();
+            _next = 0;
+            Tree<Infos>::computeInclusive(n, _values);
+        }
+        return _values[_next++];
+    }
+
+private:
+    std::vector<Inclusive> _values;
+    std::size_t _next = 0;
+};
+
 template <class Infos>
 struct DumpVisitor : public Tree<Infos>::template Visitor<DumpVisitor<Infos>>  {
     using Node = typename Tree<Infos>::Node;
     using InternalNode = typename Tree<Infos>::InternalNode;
     
-    DumpVisitor(JSONWriter& writer_)
-        : writer(writer_) {}
+    /**
+     * @param calibration_ cost of the instrumentation subtracted from the
+     *        elapsed times to get the "corrected" ones (see BenchOverhead.h).
+     */
+    DumpVisitor(JSONWriter& writer_, const OverheadCalibration& calibration_ = {})
+        : writer(writer_), calibration(calibration_) {}
 
     void visit(const Node& n) {
         writer.pushMapStart();
-        writer.pushMapKeyConst("name");
-        writer.pushString(n.value.name);
-        for (const auto& comment : n.value.comments) {
-            writer.pushMapKeyRaw(comment.first);
-            writer.pushString(comment.second);
+        dumpInfos(n.value, Inclusive::of(n.value));
+        if constexpr (is_aggregated_v<Infos>) {
+            dumpStats(n.value);
         }
-        writer.pushMapKeyConst("elapsed");
-        writer.pushString(prettyPrint(n.value.elapsed.count())); 
-
         writer.pushMapEnd();
     }
 
     void visit(const InternalNode& n) {
         writer.pushMapStart();
-        writer.pushMapKeyConst("name");
-        writer.pushString(n.value.name);
-        for (const auto& comment : n.value.comments) {
-            writer.pushMapKeyRaw(comment.first);
-            writer.pushString(comment.second);
-        }
-        writer.pushMapKeyRaw("elapsed");
-        writer.pushString(prettyPrint(n.value.elapsed.count()));
+        dumpInfos(n.value, inclusive.next(n));
 
         writer.pushMapKeyConst("sub");
         writer.pushArrayStart();
@@ -166,7 +379,128 @@ struct DumpVisitor : public Tree<Infos>::template Visitor<DumpVisitor<Infos>>  {
         writer.pushMapEnd(); // current sub `name`
     }
 
+    // `values` are the ones of the subtree, see `Inclusive`
+    template <typename Values>
+    void dumpInfos(const Infos& infos, const Values& values) {
+        writer.pushMapKeyConst("name");
+        writer.pushString(infos.name);
+        for (const auto& comment : infos.comments) {
+            writer.pushMapKeyRaw(comment.key);
+            writer.pushString(commentToString(comment.value));
+        }
+        writer.pushMapKeyConst("elapsed");
+        writer.pushString(prettyPrint(values.elapsed.count()));
+        if constexpr (std::is_same_v<Overhead_t, Overhead>) {
+            writer.pushMapKeyConst("corrected");
+            writer.pushString(prettyPrint(calibration.correct(values.elapsed, values.overhead).count()));
+        }
+
+        if constexpr (is_aggregated_v<Infos>) {
+            writer.pushMapKeyConst("count");
+            writer.pushString(std::to_string(infos.count));
+        }
+
+        if constexpr (std::is_same_v<Counters_t, HardwareCounters>) {
+            if (values.counters.available) {
+                dumpCounters(values.counters);
+            }
+        }
+
+        if constexpr (std::is_same_v<Allocations_t, Allocations>) {
+            dumpAllocations(values.allocations);
+        }
+
+        if constexpr (std::is_same_v<CpuTime_t, CpuTime>) {
+            dumpCpuTime(values.cpuTime, values.elapsed);
+        }
+
+        dumpMetrics(infos.metrics, values.elapsed);
+    }
+
+    void dumpCounters(const HardwareCounters& counters) {
+        writer.pushMapKeyConst("cycles");
+        writer.pushString(std::to_string(counters.cycles));
+        writer.pushMapKeyConst("instructions");
+        writer.pushString(std::to_string(counters.instructions));
+
+        char ipc[32];
+        snprintf(ipc, sizeof(ipc), "%.2f", counters.ipc());
+        writer.pushMapKeyConst("ipc");
+        writer.pushString(ipc);
+
+        writer.pushMapKeyConst("l1d_misses");
+        writer.pushString(std::to_string(counters.l1dMisses));
+        writer.pushMapKeyConst("llc_misses");
+        writer.pushString(std::to_string(counters.llcMisses));
+        writer.pushMapKeyConst("branch_misses");
+        writer.pushString(std::to_string(counters.branchMisses));
+    }
+
+    void dumpAllocations(const Allocations& allocations) {
+        writer.pushMapKeyConst("allocations");
+        writer.pushString(std::to_string(allocations.count));
+        writer.pushMapKeyConst("allocated_bytes");
+        writer.pushString(std::to_string(allocations.allocated));
+        writer.pushMapKeyConst("freed_bytes");
+        writer.pushString(std::to_string(allocations.freed));
+    }
+
+    // The elapsed time is the wall time, the remainder is spent off CPU
+    void dumpCpuTime(const CpuTime& cpuTime, std::chrono::nanoseconds elapsed) {
+        writer.pushMapKeyConst("cpu_time");
+        writer.pushString(prettyPrint(cpuTime.cpu.count()));
+        writer.pushMapKeyConst("off_cpu");
+        writer.pushString(prettyPrint(std::max(elapsed - cpuTime.cpu, std::chrono::nanoseconds{}).count()));
+    }
+
+    // The metrics of the node and their rates over `elapsed`
+    void dumpMetrics(const typename Infos::Metrics_t& metrics, std::chrono::nanoseconds elapsed) {
+        for (const auto& metric : metrics) {
+            writer.pushMapKeyRaw(metric.key);
+            writer.pushString(metric.toString());
+            if (elapsed.count() <= 0) {
+                continue;
+            }
+
+            const double total = metric.toDouble();
+            char rate[32];
+            snprintf(rate, sizeof(rate), "%.4g", total * 1e9 / elapsed.count());
+            writer.pushMapKey(std::string(metric.key) + "_per_s");
+            writer.pushString(rate);
+
+            if (total > 0 && std::strcmp(metric.key, itemsMetric) == 0) {
+                snprintf(rate, sizeof(rate), "%.2f", elapsed.count() / total);
+                writer.pushMapKeyConst("ns_per_item");
+                writer.pushString(rate);
+            }
+        }
+    }
+
+    // Per sample statistics, only meaningful for leaves
+    void dumpStats(const Infos& infos) {
+        writer.pushMapKeyConst("min");
+        writer.pushString(prettyPrint(infos.min.count()));
+        writer.pushMapKeyConst("max");
+        writer.pushString(prettyPrint(infos.max.count()));
+        writer.pushMapKeyConst("mean");
+        writer.pushString(prettyPrint(AULong(infos.mean)));
+        writer.pushMapKeyConst("stddev");
+        writer.pushString(prettyPrint(AULong(infos.stddev())));
+
+        if (infos.histogram) {
+            static constexpr std::pair<const char*, double> percentiles[] = {
+                { "p50", 50. }, { "p90", 90. }, { "p99", 99. }, { "p99.9", 99.9 }
+            };
+            for (const auto& [key, percentile] : percentiles) {
+                writer.pushMapKeyConst(key);
+                writer.pushString(prettyPrint(infos.histogram->valueAt(percentile)));
+            }
+        }
+    }
+
     JSONWriter& writer;
+    OverheadCalibration calibration;
+    InclusiveValues<Infos> inclusive;
 };
 
 } // namespace bench
@@ -0,0 +1,304 @@
+/**
+ * Convert a binary bench dump (see BenchBinary.h) into JSON or CSV.
+ *
+ * Usage: bench_convert <dump.bin> [json|csv]
+ *
+ * The dumps of every version up to the current one are read, the measures
+ * only exist since version 2.
+ */
+#include "utils/bench/BenchBinary.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+struct Node {
+    AULong parent;
+    AULong name;
+    AULong flags;
+    AULong elapsed;
+    std::vector<std::pair<AULong, AULong>> comments;
+    std::vector<std::tuple<AULong, AULong, AULong>> measures; // key, kind, value
+    AULong stats[5] = {}; // count, min, max, mean, stddev
+};
+
+struct Thread {
+    std::string_view id;
+    std::vector<std::string_view> strings;
+    std::vector<Node> nodes;
+};
+
+/**
+ * @return false when the buffer is truncated or its content is inconsistent:
+ *         a string index out of the table, a parent which is not an internal
+ *         node before its child, an unknown measure kind.
+ */
+bool parseThread(const char*& it, const char* end, AULong version, Thread& thread) {
+    using namespace bench::binary;
+
+    // Every element takes at least one byte, do not allocate for garbage counts
+    auto fits = [&](AULong n) { return n <= AULong(end - it); };
+
+    AULong nbStrings, nbNodes;
+    if (!getString(it, end, thread.id) || !getVarint(it, end, nbStrings) || !fits(nbStrings)) {
+        return false;
+    }
+
+    thread.strings.resize(nbStrings);
+    for (auto& str : thread.strings) {
+        if (!getString(it, end, str)) {
+            return false;
+        }
+    }
+
+    if (!getVarint(it, end, nbNodes) || !fits(nbNodes)) {
+        return false;
+    }
+
+    thread.nodes.resize(nbNodes);
+    for (AULong i = 0; i < nbNodes; ++i) {
+        Node& node = thread.nodes[i];
+        AULong nbComments;
+        if (!getVarint(it, end, node.parent) || !getVarint(it, end, node.name)
+            || !getVarint(it, end, node.flags) || !getVarint(it, end, node.elapsed)
+            || !getVarint(it, end, nbComments) || !fits(nbComments)) {
+            return false;
+        }
+
+        node.comments.resize(nbComments);
+        for (auto& [key, value] : node.comments) {
+            if (!getVarint(it, end, key) || !getVarint(it, end, value)
+                || key >= nbStrings || value >= nbStrings) {
+                return false;
+            }
+        }
+
+        AULong nbMeasures = 0;
+        if (version >= 2 && (!getVarint(it, end, nbMeasures) || !fits(nbMeasures))) {
+            return false;
+        }
+        node.measures.resize(nbMeasures);
+        for (auto& [key, kind, value] : node.measures) {
+            if (!getVarint(it, end, key) || !getVarint(it, end, kind)
+                || !getVarint(it, end, value) || key >= nbStrings || kind > real) {
+                return false;
+            }
+        }
+
+        if (node.flags & aggregated) {
+            for (auto& stat : node.stats) {
+                if (!getVarint(it, end, stat)) {
+                    return false;
+                }
+            }
+        }
+
+        // Pre-order: the parent (index + 1) is an internal node written before
+        if (node.name >= nbStrings || node.parent > i
+            || (node.parent && !(thread.nodes[node.parent - 1].flags & internal))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string formatMeasure(AULong kind, AULong value) {
+    if (kind == bench::binary::nanoseconds) {
+        return bench::prettyPrint(value);
+    }
+    if (kind == bench::binary::real) {
+        double real;
+        memcpy(&real, &value, sizeof(real));
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.4g", real);
+        return buf;
+    }
+    return std::to_string(value);
+}
+
+void writeJSONString(std::ostream& out, std::string_view str) {
+    out << '"';
+    for (const char c : str) {
+        switch (c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            default: out << c;
+        }
+    }
+    out << '"';
+}
+
+void writeCSVString(std::ostream& out, std::string_view str) {
+    out << '"';
+    for (const char c : str) {
+        if (c == '"') out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+void writeJSONNode(std::ostream& out, const Thread& thread,
+                   const std::vector<std::vector<AULong>>& children, AULong i) {
+    static const char* statNames[] = { "count", "min", "max", "mean", "stddev" };
+    const Node& node = thread.nodes[i];
+
+    out << "{\"name\":";
+    writeJSONString(out, thread.strings[node.name]);
+    for (const auto& [key, value] : node.comments) {
+        out << ',';
+        writeJSONString(out, thread.strings[key]);
+        out << ':';
+        writeJSONString(out, thread.strings[value]);
+    }
+    out << ",\"elapsed\":\"" << bench::prettyPrint(node.elapsed) << '"';
+    for (const auto& [key, kind, value] : node.measures) {
+        out << ',';
+        writeJSONString(out, thread.strings[key]);
+        out << ':';
+        writeJSONString(out, formatMeasure(kind, value));
+    }
+
+    if (node.flags & bench::binary::aggregated) {
+        out << ",\"count\":\"" << node.stats[0] << '"';
+        for (std::size_t s = 1; s < 5 && !(node.flags & bench::binary::internal); ++s) {
+            out << ",\"" << statNames[s] << "\":\"" << bench::prettyPrint(node.stats[s]) << '"';
+        }
+    }
+
+    if (node.flags & bench::binary::internal) {
+        out << ",\"sub\":[";
+        // `children` is indexed by the parent field, i.e. node index + 1
+        for (std::size_t c = 0; c < children[i + 1].size(); ++c) {
+            if (c) out << ',';
+            writeJSONNode(out, thread, children, children[i + 1][c]);
+        }
+        out << ']';
+    }
+    out << '}';
+}
+
+void writeJSON(std::ostream& out, const std::vector<Thread>& threads) {
+    for (const auto& thread : threads) {
+        std::vector<std::vector<AULong>> children(thread.nodes.size() + 1);
+        for (AULong i = 0; i < thread.nodes.size(); ++i) {
+            children[thread.nodes[i].parent].push_back(i);
+        }
+
+        out << '{';
+        writeJSONString(out, thread.id);
+        out << ":[";
+        // Top level nodes are the children of the virtual node 0
+        for (std::size_t c = 0; c < children[0].size(); ++c) {
+            if (c) out << ',';
+            writeJSONNode(out, thread, children, children[0][c]);
+        }
+        out << "]}\n";
+    }
+}
+
+void writeCSV(std::ostream& out, const std::vector<Thread>& threads) {
+    out << "thread,node,parent,depth,name,elapsed_ns,count,min_ns,max_ns,mean_ns,stddev_ns,comments,measures\n";
+    for (const auto& thread : threads) {
+        std::vector<AULong> depths(thread.nodes.size());
+        for (AULong i = 0; i < thread.nodes.size(); ++i) {
+            const Node& node = thread.nodes[i];
+            // Pre-order: the parent is always before its children
+            depths[i] = node.parent ? depths[node.parent - 1] + 1 : 0;
+
+            out << thread.id << ',' << i << ',' << AInt(node.parent) - 1 << ','
+                << depths[i] << ',';
+            writeCSVString(out, thread.strings[node.name]);
+            out << ',' << node.elapsed;
+            for (const auto stat : node.stats) {
+                out << ',';
+                if (node.flags & bench::binary::aggregated) {
+                    out << stat;
+                }
+            }
+
+            std::string comments;
+            for (std::size_t c = 0; c < node.comments.size(); ++c) {
+                if (c) comments += ';';
+                comments.append(thread.strings[node.comments[c].first]);
+                comments += '=';
+                comments.append(thread.strings[node.comments[c].second]);
+            }
+            out << ',';
+            writeCSVString(out, comments);
+
+            // Raw numbers, unlike the JSON output
+            std::string measures;
+            for (std::size_t m = 0; m < node.measures.size(); ++m) {
+                const auto& [key, kind, value] = node.measures[m];
+                if (m) measures += ';';
+                measures.append(thread.strings[key]);
+                measures += '=';
+                measures += kind == bench::binary::real ? formatMeasure(kind, value) : std::to_string(value);
+            }
+            out << ',';
+            writeCSVString(out, measures);
+            out << '\n';
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <dump.bin> [json|csv]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    const std::string data = content.str();
+
+    const char* it = data.data();
+    const char* end = it + data.size();
+    AULong version;
+    if (data.size() < sizeof(bench::binary::magic)
+        || data.compare(0, sizeof(bench::binary::magic), bench::binary::magic,
+                        sizeof(bench::binary::magic)) != 0
+        || !bench::binary::getVarint(it += sizeof(bench::binary::magic), end, version)
+        || version == 0 || version > bench::binary::version) {
+        std::cerr << argv[1] << " is not a supported binary bench dump" << std::endl;
+        return 1;
+    }
+
+    std::vector<Thread> threads;
+    while (it != end) {
+        if (!parseThread(it, end, version, threads.emplace_back())) {
+            std::cerr << argv[1] << " is truncated or corrupted" << std::endl;
+            return 1;
+        }
+    }
+
+    const std::string_view format = argc > 2 ? argv[2] : "json";
+    if (format == "csv") {
+        writeCSV(std::cout, threads);
+    } else if (format == "json") {
+        writeJSON(std::cout, threads);
+    } else {
+        std::cerr << "Unknown format " << format << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#define ALGOLIA_PROFILING 0
+
+#include <benchmark/benchmark.h>
+
+#include "utils/bench/Bench.h"
+
+/*********************************************
+ *    Bench objects disabled at compile time *
+ *********************************************/
+
+// Same workload as bench_switch.cpp: the bench objects must cost nothing
+static std::size_t work(std::size_t i) {
+  benchmark::DoNotOptimize(i *= 3);
+  return i;
+}
+
+static void BM_NoBench(benchmark::State& state) {
+  std::size_t i = 0;
+  for (auto _ : state) {
+      i = work(i);
+  }
+}
+
+BENCHMARK(BM_NoBench);
+
+static void BM_CompileTimeDisabledScope(benchmark::State& state) {
+  std::size_t i = 0;
+  for (auto _ : state) {
+      bench::BenchScope scope("scope");
+      i = work(i);
+  }
+}
+
+BENCHMARK(BM_CompileTimeDisabledScope);
+
+static void BM_CompileTimeDisabledBunch(benchmark::State& state) {
+  std::size_t i = 0;
+  for (auto _ : state) {
+      bench::BenchBunch bunch("bunch");
+      bunch.addComment("i", i);
+      i = work(i);
+  }
+}
+
+BENCHMARK(BM_CompileTimeDisabledBunch);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,425 @@
+#define ALGOLIA_PROFILING 1
+
+#include <benchmark/benchmark.h>
+
+#include "utils/bench/Bench.h"
+#include "utils/bench/BenchFlatTree.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+
+/*********************************************
+ *         Bench objects overhead            *
+ *********************************************/
+
+// Every recorded scope adds a node to the thread's tree. The iterations are
+// bounded so that the trees of all the threads fit in memory.
+static constexpr std::size_t maxIterations = 1 << 16;
+
+static void BM_BenchScope(benchmark::State& state) {
+  for (auto _ : state) {
+      bench::BenchScope scope("scope");
+  }
+}
+
+BENCHMARK(BM_BenchScope)->Iterations(maxIterations)->ThreadRange(1, 32)->UseRealTime();
+
+// Record the scopes under `depth - 1` nested bunches
+static void recordAtDepth(benchmark::State& state, int64_t depth) {
+  if (depth > 1) {
+      bench::BenchBunch bunch("bunch");
+      recordAtDepth(state, depth - 1);
+      return;
+  }
+  for (auto _ : state) {
+      bench::BenchScope scope("scope");
+  }
+}
+
+static void BM_BenchScopeAtDepth(benchmark::State& state) {
+  recordAtDepth(state, state.range(0));
+}
+
+BENCHMARK(BM_BenchScopeAtDepth)->Iterations(maxIterations)->RangeMultiplier(2)->Range(1, 64);
+
+// A scope recorded into a task context instead of the thread's tree
+static void BM_ContextBenchScope(benchmark::State& state) {
+  bench::BenchContext context("task");
+  bench::BenchContext<>::Attached attached(context);
+  for (auto _ : state) {
+      bench::BenchScope scope("scope");
+  }
+}
+
+BENCHMARK(BM_ContextBenchScope)->Iterations(maxIterations);
+
+// A scope reads it twice when ALGOLIA_PROFILING_CPU_TIME is enabled
+static void BM_ThreadCpuTime(benchmark::State& state) {
+  for (auto _ : state) {
+      benchmark::DoNotOptimize(bench::threadCpuTime());
+  }
+}
+
+BENCHMARK(BM_ThreadCpuTime);
+
+// A scope counting the items and the bytes it processed
+static void BM_BenchScopeCounters(benchmark::State& state) {
+  for (auto _ : state) {
+      bench::BenchScope scope("scope");
+      scope.addItems(1);
+      scope.addCounter("bytes", 64);
+  }
+}
+
+BENCHMARK(BM_BenchScopeCounters)->Iterations(maxIterations);
+
+// Only one iteration out of `rate` is measured and added to the tree
+static void BM_SampledBenchScope(benchmark::State& state) {
+  bench::Sampler sampler(state.range(0));
+  for (auto _ : state) {
+      bench::SampledBenchScope scope("scope", sampler);
+  }
+}
+
+BENCHMARK(BM_SampledBenchScope)->Iterations(maxIterations)->Arg(1)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_SampledMacro(benchmark::State& state) {
+  for (auto _ : state) {
+      BENCH_SAMPLED_SCOPE("scope", 4096);
+  }
+}
+
+BENCHMARK(BM_SampledMacro)->Iterations(maxIterations);
+
+template <typename Clock>
+static void BM_ClockStartStop(benchmark::State& state) {
+  std::chrono::nanoseconds acc{};
+  for (auto _ : state) {
+      const auto start = Clock::start();
+      acc += Clock::elapsed(start, Clock::stop());
+  }
+  benchmark::DoNotOptimize(acc);
+}
+
+BENCHMARK_TEMPLATE(BM_ClockStartStop, bench::SteadyClock);
+#if ALGOLIA_PROFILING_TSC == 1
+BENCHMARK_TEMPLATE(BM_ClockStartStop, bench::TscClock);
+#endif
+
+template <typename Clock>
+static void BM_ScopedTimer(benchmark::State& state) {
+  std::chrono::nanoseconds acc{};
+  for (auto _ : state) {
+      bench::ScopedTimer<std::chrono::nanoseconds, Clock> timer(acc);
+  }
+  benchmark::DoNotOptimize(acc);
+}
+
+BENCHMARK_TEMPLATE(BM_ScopedTimer, bench::SteadyClock);
+#if ALGOLIA_PROFILING_TSC == 1
+BENCHMARK_TEMPLATE(BM_ScopedTimer, bench::TscClock);
+#endif
+
+// Check the conversion of ticks back to nanoseconds against steady_clock
+template <typename Clock>
+static void BM_ClockAccuracy(benchmark::State& state) {
+  for (auto _ : state) {
+      const auto steadyStart = std::chrono::steady_clock::now();
+      const auto start = Clock::start();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      const auto elapsed = Clock::elapsed(start, Clock::stop());
+      const auto steadyElapsed = std::chrono::steady_clock::now() - steadyStart;
+      state.counters["ns_diff"] = double((steadyElapsed - elapsed).count());
+  }
+}
+
+#if ALGOLIA_PROFILING_TSC == 1
+BENCHMARK_TEMPLATE(BM_ClockAccuracy, bench::TscClock)->Iterations(100);
+#endif
+
+static void BM_HistogramRecord(benchmark::State& state) {
+  bench::LatencyHistogram histogram;
+  AULong ns = 1;
+  for (auto _ : state) {
+      histogram.record(ns);
+      ns = ns * 6364136223846793005ull + 1442695040888963407ull; // Spread over all the buckets
+      ns >>= 24;
+  }
+  benchmark::DoNotOptimize(histogram.total());
+}
+
+BENCHMARK(BM_HistogramRecord);
+
+static void BM_AggregatedBenchScope(benchmark::State& state) {
+  for (auto _ : state) {
+      bench::BenchScope<bench::AggregatedBenchInfos> scope("scope");
+  }
+}
+
+BENCHMARK(BM_AggregatedBenchScope)->ThreadRange(1, 32)->UseRealTime();
+
+// The trees are handed over to a thread writing them to /dev/null, the
+// iterations do not need to be bounded
+static int streamFd = -1;
+
+static void startStreaming(const benchmark::State&) {
+  streamFd = open("/dev/null", O_WRONLY);
+  bench::getEnvInstance().startStreaming(streamFd, std::chrono::milliseconds(10));
+}
+
+static void stopStreaming(const benchmark::State&) {
+  bench::getEnvInstance().stopStreaming();
+  close(streamFd);
+}
+
+static void BM_StreamedBenchScope(benchmark::State& state) {
+  for (auto _ : state) {
+      bench::BenchBunch bunch("bunch");
+      bench::BenchScope scope("scope");
+  }
+}
+
+BENCHMARK(BM_StreamedBenchScope)->ThreadRange(1, 32)->UseRealTime()
+    ->Setup(startStreaming)->Teardown(stopStreaming);
+
+// Extra cost of a bench when ALGOLIA_PROFILING_TRACE is enabled
+static void BM_TraceEventAdd(benchmark::State& state) {
+  static bench::TraceBuffer buffer; // Too big for the stack
+  AULong start = 0;
+  for (auto _ : state) {
+      buffer.add({ "scope", start++, 42 });
+  }
+  benchmark::DoNotOptimize(buffer.size());
+}
+
+BENCHMARK(BM_TraceEventAdd);
+
+/*********************************************
+ *            Tree structures                *
+ *********************************************/
+
+// `bunches` bunches of 999 leaves
+template <typename TreeT>
+static void fillTree(TreeT& t, std::size_t bunches) {
+  for (std::size_t i = 0; i < bunches; ++i) {
+      t.addInternal(std::chrono::nanoseconds(i), "bunch", bench::BenchInfos::Comments_t{})
+          .addComment("i", i);
+      for (std::size_t j = 0; j < 999; ++j) {
+          t.addLeaf(std::chrono::nanoseconds(j * 1000 + i), "leaf", bench::BenchInfos::Comments_t{});
+      }
+      t.goUp();
+  }
+}
+
+// The nodes of `Tree` are never freed from the arena: 100 bunches (~100k
+// nodes) per iteration and bounded iterations
+template <template <class> class TreeT>
+static void BM_TreeInsert(benchmark::State& state) {
+  for (auto _ : state) {
+      TreeT<bench::BenchInfos> tree;
+      fillTree(tree, 100);
+      benchmark::DoNotOptimize(tree.size());
+  }
+  state.SetItemsProcessed(state.iterations() * 100 * 1000);
+}
+
+BENCHMARK_TEMPLATE(BM_TreeInsert, bench::Tree)->Iterations(32)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_TreeInsert, bench::FlatTree)->Iterations(32)->Unit(benchmark::kMillisecond);
+
+static void BM_FlatTreeInsertReserved(benchmark::State& state) {
+  for (auto _ : state) {
+      bench::FlatTree<bench::BenchInfos> tree;
+      tree.reserve(100 * 1000);
+      fillTree(tree, 100);
+      benchmark::DoNotOptimize(tree.size());
+  }
+  state.SetItemsProcessed(state.iterations() * 100 * 1000);
+}
+
+BENCHMARK(BM_FlatTreeInsertReserved)->Iterations(32)->Unit(benchmark::kMillisecond);
+
+// A bunch of 16 call sites merged at each iteration
+template <template <class> class TreeT>
+static void BM_TreeMerge(benchmark::State& state) {
+  TreeT<bench::AggregatedBenchInfos> tree;
+  auto infos = [](const char* name, unsigned line, AULong ns) {
+      bench::AggregatedBenchInfos ret(std::chrono::nanoseconds(ns), name);
+      ret.file = __FILE__;
+      ret.line = line;
+      return ret;
+  };
+
+  AULong ns = 0;
+  for (auto _ : state) {
+      tree.mergeInternal(infos("bunch", 0, 0));
+      for (unsigned line = 0; line < 16; ++line) {
+          tree.mergeLeaf(infos("leaf", line, ++ns));
+      }
+      tree.goUp();
+  }
+  benchmark::DoNotOptimize(tree.size());
+  state.SetItemsProcessed(state.iterations() * 17);
+}
+
+BENCHMARK_TEMPLATE(BM_TreeMerge, bench::Tree);
+BENCHMARK_TEMPLATE(BM_TreeMerge, bench::FlatTree);
+
+/*********************************************
+ *            Dump formats                   *
+ *********************************************/
+
+// 1000 bunches of 999 leaves: ~1M nodes
+// Leaked on purpose: their nodes live in the arena of the main thread
+template <template <class> class TreeT>
+static const TreeT<bench::BenchInfos>& bigTree() {
+  static const auto* tree = [] {
+      auto* t = new TreeT<bench::BenchInfos>();
+      fillTree(*t, 1000);
+      return t;
+  }();
+  return *tree;
+}
+
+static void BM_DumpJSON(benchmark::State& state) {
+  const auto& tree = bigTree<bench::Tree>();
+  std::size_t size = 0;
+  for (auto _ : state) {
+      bench::OutBuff_t out;
+      JSONWriter writer(out);
+      bench::DumpVisitor<bench::BenchInfos> v{ writer };
+      tree.accept(v);
+      size = out.size();
+  }
+  state.counters["bytes"] = size;
+}
+
+BENCHMARK(BM_DumpJSON)->Unit(benchmark::kMillisecond);
+
+static void BM_DumpJSONFlat(benchmark::State& state) {
+  const auto& tree = bigTree<bench::FlatTree>();
+  std::size_t size = 0;
+  for (auto _ : state) {
+      bench::OutBuff_t out;
+      JSONWriter writer(out);
+      bench::FlatDumpVisitor<bench::BenchInfos> v{ writer };
+      tree.accept(v);
+      size = out.size();
+  }
+  state.counters["bytes"] = size;
+}
+
+BENCHMARK(BM_DumpJSONFlat)->Unit(benchmark::kMillisecond);
+
+static void BM_DumpBinary(benchmark::State& state) {
+  const auto& tree = bigTree<bench::Tree>();
+  std::size_t size = 0;
+  for (auto _ : state) {
+      std::string out;
+      bench::BinaryDumpVisitor<bench::BenchInfos> v;
+      tree.accept(v);
+      v.flush(out, "0");
+      size = out.size();
+  }
+  state.counters["bytes"] = size;
+}
+
+BENCHMARK(BM_DumpBinary)->Unit(benchmark::kMillisecond);
+
+// Streamed by chunks of 1MB, as when writing to a file
+static void BM_DumpFolded(benchmark::State& state) {
+  const auto& tree = bigTree<bench::Tree>();
+  std::size_t size = 0;
+  for (auto _ : state) {
+      std::string out;
+      size = 0;
+      bench::FoldedStackVisitor<bench::BenchInfos> v{ out, "thread",
+          [&size](std::string& chunk) { size += chunk.size(); } };
+      tree.accept(v);
+      size += out.size();
+  }
+  state.counters["bytes"] = size;
+}
+
+BENCHMARK(BM_DumpFolded)->Unit(benchmark::kMillisecond);
+
+// The big tree merged as if 8 threads had recorded it
+static void BM_MergeThreads(benchmark::State& state) {
+  const auto& tree = bigTree<bench::Tree>();
+  for (auto _ : state) {
+      bench::MergedProfile profile;
+      for (int thread = 0; thread < 8; ++thread) {
+          profile.add(tree, std::to_string(thread));
+      }
+      benchmark::DoNotOptimize(profile.nodes().size());
+  }
+  state.SetItemsProcessed(state.iterations() * 8 * tree.size());
+}
+
+BENCHMARK(BM_MergeThreads)->Unit(benchmark::kMillisecond);
+
+static void BM_DumpTrace(benchmark::State& state) {
+  static bench::TraceBuffer buffer;
+  for (std::size_t i = 0; i < buffer.capacity; ++i) {
+      buffer.add({ "scope", i * 100, 42 });
+  }
+  for (auto _ : state) {
+      std::string out = bench::chromeTraceHeader;
+      buffer.foreach([&](const bench::TraceEvent& event) {
+          bench::pushChromeTraceEvent(out, event, 0);
+      });
+      benchmark::DoNotOptimize(out.data());
+  }
+}
+
+BENCHMARK(BM_DumpTrace)->Unit(benchmark::kMillisecond);
+
+/*********************************************
+ *            Profiled mutexes               *
+ *********************************************/
+
+template <typename Mutex>
+static Mutex& contendedMutex() {
+  if constexpr (std::is_default_constructible_v<Mutex>) {
+      static Mutex mutex;
+      return mutex;
+  } else {
+      static Mutex mutex("contended");
+      return mutex;
+  }
+}
+
+// Every thread increments a shared counter under the lock
+template <typename Mutex>
+static void BM_LockContention(benchmark::State& state) {
+  static AULong counter = 0;
+  auto& mutex = contendedMutex<Mutex>();
+  for (auto _ : state) {
+      std::lock_guard<Mutex> lock(mutex);
+      benchmark::DoNotOptimize(++counter);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_LockContention, std::mutex)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LockContention, bench::ProfiledMutex)->ThreadRange(1, 32)->UseRealTime();
+
+// Every thread reads a shared counter under a shared lock
+template <typename Mutex>
+static void BM_SharedLockContention(benchmark::State& state) {
+  static AULong counter = 0;
+  auto& mutex = contendedMutex<Mutex>();
+  for (auto _ : state) {
+      std::shared_lock<Mutex> lock(mutex);
+      benchmark::DoNotOptimize(counter);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_SharedLockContention, std::shared_mutex)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedLockContention, bench::ProfiledSharedMutex)->ThreadRange(1, 32)->UseRealTime();
+
+BENCHMARK_MAIN();
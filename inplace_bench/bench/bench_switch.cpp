@@ -0,0 +1,79 @@
+#define ALGOLIA_PROFILING 1
+#define ALGOLIA_PROFILING_RUNTIME 1
+
+#include <benchmark/benchmark.h>
+
+#include "utils/bench/Bench.h"
+
+/*********************************************
+ *      Runtime switched bench objects       *
+ *********************************************/
+
+// Same workload in every benchmark, see bench_disabled.cpp for the same
+// benchmarks when the profiling is disabled at compile time.
+static std::size_t work(std::size_t i) {
+  benchmark::DoNotOptimize(i *= 3);
+  return i;
+}
+
+static void BM_NoBench(benchmark::State& state) {
+  std::size_t i = 0;
+  for (auto _ : state) {
+      i = work(i);
+  }
+}
+
+BENCHMARK(BM_NoBench);
+
+static void BM_RuntimeDisabledScope(benchmark::State& state) {
+  bench::disableProfiling();
+  std::size_t i = 0;
+  for (auto _ : state) {
+      bench::BenchScope scope("scope");
+      i = work(i);
+  }
+}
+
+BENCHMARK(BM_RuntimeDisabledScope)->ThreadRange(1, 32)->UseRealTime();
+
+static void BM_RuntimeDisabledBunch(benchmark::State& state) {
+  bench::disableProfiling();
+  std::size_t i = 0;
+  for (auto _ : state) {
+      bench::BenchBunch bunch("bunch");
+      bunch.addComment("i", i);
+      i = work(i);
+  }
+}
+
+BENCHMARK(BM_RuntimeDisabledBunch);
+
+// Only the categories given to the bench object are checked
+static void BM_RuntimeDisabledCategory(benchmark::State& state) {
+  static constexpr bench::Category io = 2;
+  bench::enableProfiling(bench::category::main);
+  bench::disableProfiling(io);
+  std::size_t i = 0;
+  for (auto _ : state) {
+      bench::BenchScope scope("scope", io);
+      i = work(i);
+  }
+  bench::disableProfiling();
+}
+
+BENCHMARK(BM_RuntimeDisabledCategory);
+
+// Every enabled scope adds a node to the thread's tree, bound the iterations
+static void BM_RuntimeEnabledScope(benchmark::State& state) {
+  bench::enableProfiling();
+  std::size_t i = 0;
+  for (auto _ : state) {
+      bench::BenchScope scope("scope");
+      i = work(i);
+  }
+  bench::disableProfiling();
+}
+
+BENCHMARK(BM_RuntimeEnabledScope)->Iterations(1 << 16);
+
+BENCHMARK_MAIN();
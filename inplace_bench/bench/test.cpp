@@ -0,0 +1,462 @@
+#define ALGOLIA_PROFILING 1
+#define ALGOLIA_PROFILING_ALLOCATIONS 1
+#define ALGOLIA_PROFILING_CPU_TIME 1
+
+#include "utils/bench/Bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Every heap allocation of the thread is counted into `bench::threadAllocations`
+BENCH_TRACK_ALLOCATIONS()
+
+static void record(int i) {
+    bench::BenchBunch bunch("bunch");
+    bunch.addComment("i", i);
+    for (int j = 0; j < 10; ++j) {
+        bench::BenchScope scope("scope");
+        scope.addComment("j", j);
+        scope.addComment("ratio", j / 10.);
+        scope.addComment("kind", "literal");
+        scope.addItems(1);
+    }
+}
+
+static const char emptyName[] = "empty";
+static const char outerName[] = "outer";
+
+// Empty scopes, alone or nesting other empty scopes
+static void recordEmpty() {
+    { bench::BenchScope scope(emptyName); }
+    bench::BenchScope outer(outerName);
+    for (int i = 0; i < 16; ++i) {
+        bench::BenchScope scope(emptyName);
+    }
+}
+
+// Collect the raw and corrected elapsed times of the nodes named `name`
+struct ElapsedVisitor : bench::Tree<bench::BenchInfos>::Visitor<ElapsedVisitor> {
+    explicit ElapsedVisitor(const char* name_) : name(name_) {}
+
+    template <typename Node>
+    void visit(const Node& n) {
+        if (n.value.name == name) {
+            raw.push_back(n.value.elapsed.count());
+            corrected.push_back(bench::overheadCalibration().correct(
+                n.value.elapsed, n.value.overhead).count());
+        }
+    }
+
+    static long long median(std::vector<long long> v) {
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return v[v.size() / 2];
+    }
+
+    const char* name;
+    std::vector<long long> raw;
+    std::vector<long long> corrected;
+};
+
+// The corrected time of an empty scope has to be a small part of its raw one
+static bool checkCorrected(const char* name) {
+    ElapsedVisitor v(name);
+    bench::BenchEnv<bench::BenchInfos>::BenchLocalEnv::getInstance().benchTree.accept(v);
+    const long long raw = ElapsedVisitor::median(v.raw);
+    const long long corrected = ElapsedVisitor::median(v.corrected);
+    std::cout << "Median " << name << " scope: raw " << raw << "ns, corrected "
+              << corrected << "ns\n";
+    return corrected * 4 <= raw;
+}
+
+static const char allocatingName[] = "allocating";
+
+struct AllocationsVisitor : bench::Tree<bench::BenchInfos>::Visitor<AllocationsVisitor> {
+    template <typename Node>
+    void visit(const Node& n) {
+        if (n.value.name == allocatingName) {
+            allocations += n.value.allocations;
+        }
+    }
+
+    bench::Allocations allocations;
+};
+
+// A scope allocating and freeing 1000 bytes records it
+static bool checkAllocations() {
+    {
+        bench::BenchScope scope(allocatingName);
+        delete[] new char[1000];
+    }
+
+    AllocationsVisitor v;
+    bench::BenchEnv<bench::BenchInfos>::BenchLocalEnv::getInstance().benchTree.accept(v);
+    std::cout << "Allocating scope: " << v.allocations.count << " allocation(s), "
+              << v.allocations.allocated << " bytes allocated, "
+              << v.allocations.freed << " bytes freed\n";
+    return v.allocations.count == 1 && v.allocations.allocated >= 1000
+           && v.allocations.freed == v.allocations.allocated;
+}
+
+static const char throughputName[] = "throughput";
+
+struct MetricsVisitor : bench::Tree<bench::BenchInfos>::Visitor<MetricsVisitor> {
+    template <typename Node>
+    void visit(const Node& n) {
+        if (n.value.name == throughputName) {
+            for (const auto& metric : n.value.metrics) {
+                values.push_back(metric.toString());
+            }
+        }
+    }
+
+    std::vector<std::string> values;
+};
+
+// The counters of a scope are summed and stay integers unless given a double
+static bool checkMetrics() {
+    {
+        bench::BenchScope scope(throughputName);
+        scope.addItems(10);
+        scope.addCounter("bytes", 1000u);
+        scope.addItems(10);
+        scope.addCounter("bytes", 0.5);
+    }
+
+    MetricsVisitor v;
+    bench::BenchEnv<bench::BenchInfos>::BenchLocalEnv::getInstance().benchTree.accept(v);
+    std::cout << "Throughput scope metrics:";
+    for (const auto& value : v.values) {
+        std::cout << ' ' << value;
+    }
+    std::cout << '\n';
+    return v.values == std::vector<std::string>{ "20", std::to_string(1000.5) };
+}
+
+static const char sleepingName[] = "sleeping";
+static const char spinningName[] = "spinning";
+
+struct CpuTimeVisitor : bench::Tree<bench::BenchInfos>::Visitor<CpuTimeVisitor> {
+    explicit CpuTimeVisitor(const char* name_) : name(name_) {}
+
+    template <typename Node>
+    void visit(const Node& n) {
+        if (n.value.name == name) {
+            elapsed += n.value.elapsed;
+            cpu += n.value.cpuTime.cpu;
+        }
+    }
+
+    const char* name;
+    std::chrono::nanoseconds elapsed{};
+    std::chrono::nanoseconds cpu{};
+};
+
+// A sleeping scope is mostly off CPU, a spinning one mostly on CPU
+static bool checkCpuTime() {
+    using namespace std::chrono_literals;
+    {
+        bench::BenchScope scope(sleepingName);
+        std::this_thread::sleep_for(20ms);
+    }
+    {
+        bench::BenchScope scope(spinningName);
+        const auto end = std::chrono::steady_clock::now() + 20ms;
+        while (std::chrono::steady_clock::now() < end) {}
+    }
+
+    auto& tree = bench::BenchEnv<bench::BenchInfos>::BenchLocalEnv::getInstance().benchTree;
+    CpuTimeVisitor sleeping(sleepingName);
+    tree.accept(sleeping);
+    CpuTimeVisitor spinning(spinningName);
+    tree.accept(spinning);
+    std::cout << "Sleeping scope: wall " << sleeping.elapsed.count() << "ns, cpu "
+              << sleeping.cpu.count() << "ns\n"
+              << "Spinning scope: wall " << spinning.elapsed.count() << "ns, cpu "
+              << spinning.cpu.count() << "ns\n";
+    return sleeping.cpu * 4 < sleeping.elapsed && spinning.cpu * 2 > spinning.elapsed;
+}
+
+static const char lockName[] = "test lock";
+
+// A thread holds the lock while another one waits for it
+static bool checkLock() {
+    using namespace std::chrono_literals;
+    bench::ProfiledMutex mutex(lockName);
+    std::atomic<bool> held = false;
+
+    std::thread holder([&] {
+        std::lock_guard<bench::ProfiledMutex> lock(mutex);
+        held = true;
+        std::this_thread::sleep_for(20ms);
+    });
+    while (!held) {}
+    { std::lock_guard<bench::ProfiledMutex> lock(mutex); }
+    holder.join();
+
+    const auto totals = bench::LockRegistry::instance().totals();
+    const auto it = std::find_if(totals.begin(), totals.end(), [](const auto& t) {
+        return t.name == lockName;
+    });
+    if (it == totals.end()) {
+        return false;
+    }
+    std::cout << "Lock: " << it->acquisitions << " acquisitions, " << it->contentions
+              << " contended, wait " << it->wait.count() << "ns, hold "
+              << it->hold.count() << "ns\n";
+    return it->acquisitions == 2 && it->contentions == 1
+           && it->wait >= 10ms && it->hold >= 20ms;
+}
+
+// A bucket holds more than 2^32 samples, as with a high sampling rate
+static bool checkHistogram() {
+    bench::LatencyHistogram histogram;
+    histogram.record(10, AULong(1) << 32);
+    histogram.record(1000);
+    const bool ok = histogram.valueAt(50) == 10 && histogram.valueAt(100) == 1000;
+    std::cout << "Histogram p50: " << histogram.valueAt(50) << "ns\n";
+    return ok;
+}
+
+// JSON of the calling thread's tree
+static std::string dumpLocalTree() {
+    std::string out;
+    JSONWriter writer(out);
+    bench::DumpVisitor<bench::BenchInfos> v{ writer };
+    bench::BenchEnv<bench::BenchInfos>::BenchLocalEnv::getInstance().benchTree.accept(v);
+    return out;
+}
+
+// Whether `json` holds the node `name` recorded by `thread` under the task
+static bool hasTaskNode(const std::string& json, const char* task, const char* name,
+                        const std::string& thread) {
+    const auto start = json.find(std::string("{\"name\":\"") + task + "\"");
+    return start != json.npos
+        && json.find(std::string("{\"name\":\"") + name + "\",\"thread\":\"" + thread + "\"",
+                     start) != json.npos;
+}
+
+// The self time of a scope excludes the scopes nested in it, which are its
+// siblings in the tree: the folded stacks add up to the measured time
+static bool checkFolded() {
+    std::string folded;
+    std::thread([&folded] {
+        {
+            bench::BenchScope outer("outer");
+            {
+                bench::BenchScope inner("inner");
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        bench::FoldedStackVisitor<bench::BenchInfos> v{ folded };
+        bench::BenchEnv<bench::BenchInfos>::BenchLocalEnv::getInstance().benchTree.accept(v);
+    }).join();
+
+    auto self = [&folded](std::string_view name) {
+        const auto pos = folded.find(std::string(name) + ' ');
+        return pos == folded.npos ? -1 : std::stoll(folded.substr(pos + name.size() + 1));
+    };
+    const long long inner = self("inner");
+    const long long outer = self("outer");
+    const bool ok = inner >= 10000000 && outer >= 5000000 && outer < 9000000;
+    std::cout << "Folded self times: inner " << inner << "ns, outer " << outer << "ns\n";
+    return ok;
+}
+
+// A task recording a segment on two threads, then finished by the main thread.
+// A scope spanning both keeps the comments added on the first, exited, thread.
+static bool checkContext() {
+    std::string first;
+    std::string second;
+    {
+        bench::BenchContext<bench::BenchInfos> context("task");
+        std::unique_ptr<bench::BenchScope<bench::BenchInfos>> spanning;
+        std::thread([&] {
+            bench::BenchContext<bench::BenchInfos>::Attached attached(context);
+            bench::BenchScope scope("first");
+            first = bench::threadIdToStr(std::this_thread::get_id());
+            spanning = std::make_unique<bench::BenchScope<bench::BenchInfos>>("spanning");
+            spanning->addComment("started", std::string(64, 'f'));
+        }).join();
+        std::thread([&] {
+            bench::BenchContext<bench::BenchInfos>::Attached attached(context);
+            bench::BenchScope scope("second");
+            second = bench::threadIdToStr(std::this_thread::get_id());
+            spanning->addComment("ended", std::string(64, 's'));
+            spanning.reset();
+        }).join();
+    }
+
+    const std::string json = dumpLocalTree();
+    const bool ok = hasTaskNode(json, "task", "first", first)
+                    && hasTaskNode(json, "task", "second", second)
+                    && json.find("{\"name\":\"spanning\",\"started\":\"" + std::string(64, 'f')
+                                 + "\",\"ended\":\"" + std::string(64, 's')
+                                 + "\",\"thread\":\"" + second + "\"") != json.npos;
+    std::cout << "Task context across threads: " << (ok ? "ok" : "missing nodes") << '\n';
+    return ok;
+}
+
+// A streamed environment gives its arena blocks away, but not the nodes that
+// another infos type recorded on the same thread
+static bool checkStreamedWithAggregated() {
+    auto& env = bench::getEnvInstance<bench::BenchInfos>();
+    const int fd = open("/dev/null", O_WRONLY);
+    env.startStreaming(fd, std::chrono::milliseconds(1));
+    std::string json;
+    std::thread([&json] {
+        for (int i = 0; i < 4 * ALGOLIA_PROFILING_STREAM_BATCH; ++i) {
+            {
+                bench::BenchScope<bench::AggregatedBenchInfos> scope("aggregated");
+                scope.addComment("kept", std::string(64, 'k'));
+            }
+            bench::BenchScope<bench::BenchInfos> scope("streamed");
+            scope.addComment("given", std::string(64, 'g'));
+        }
+        JSONWriter writer(json);
+        bench::DumpVisitor<bench::AggregatedBenchInfos> v{ writer };
+        bench::BenchEnv<bench::AggregatedBenchInfos>::BenchLocalEnv::getInstance().benchTree.accept(v);
+    }).join();
+    env.stopStreaming();
+    close(fd);
+
+    const bool ok = json.find("{\"name\":\"aggregated\",\"kept\":\"" + std::string(64, 'k') + "\"")
+                    != json.npos
+                    && json.find("\"count\":\"" + std::to_string(4 * ALGOLIA_PROFILING_STREAM_BATCH) + "\"")
+                       != json.npos;
+    std::cout << "Streamed and aggregated environments: " << (ok ? "ok" : "corrupted") << '\n';
+    return ok;
+}
+
+#if BENCH_HAS_COROUTINES
+struct Task {
+    struct promise_type : bench::BenchPromise<bench::BenchInfos> {
+        promise_type() : BenchPromise("coroutine task") {}
+
+        Task get_return_object() {
+            return { std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Resume the awaiting coroutine on a new thread
+struct HopThread {
+    std::vector<std::thread>& threads;
+    std::mutex& mutex;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.emplace_back([handle] { handle.resume(); });
+    }
+    void await_resume() {}
+};
+
+static Task hop(std::vector<std::string>& ids, std::vector<std::thread>& threads,
+                std::mutex& mutex, std::atomic<bool>& done) {
+    {
+        bench::BenchScope scope("before hop");
+        ids.push_back(bench::threadIdToStr(std::this_thread::get_id()));
+    }
+    {
+        // Its comments live in the arena of a thread exiting before it ends
+        bench::BenchScope spanning("spanning hop");
+        spanning.addComment("from", std::string(64, 'a'));
+        spanning.addCounter("hops", 1);
+        co_await HopThread{ threads, mutex };
+        spanning.addComment("to", std::string(64, 'b'));
+        spanning.addCounter("hops", 1);
+    }
+    {
+        bench::BenchScope scope("after hop");
+        ids.push_back(bench::threadIdToStr(std::this_thread::get_id()));
+    }
+    done = true;
+}
+
+// A coroutine hopping to another thread keeps a single logical tree
+static bool checkCoroutine() {
+    std::vector<std::string> ids;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::atomic<bool> done = false;
+
+    Task task = hop(ids, threads, mutex, done);
+    std::thread([&task] { task.handle.resume(); }).join();
+    while (!done) {}
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    task.handle.destroy(); // Adds the task's tree to this thread
+
+    const std::string json = dumpLocalTree();
+    const bool ok = ids.size() == 2 && ids[0] != ids[1]
+                    && hasTaskNode(json, "coroutine task", "before hop", ids[0])
+                    && json.find("{\"name\":\"spanning hop\",\"from\":\"" + std::string(64, 'a')
+                                 + "\",\"to\":\"" + std::string(64, 'b')
+                                 + "\",\"thread\":\"" + ids[1] + "\"") != json.npos
+                    && json.find("\"hops\":\"2\"") != json.npos
+                    && hasTaskNode(json, "coroutine task", "after hop", ids[1]);
+    std::cout << "Coroutine hopping threads: " << (ok ? "ok" : "missing nodes") << '\n';
+    return ok;
+}
+#else
+static bool checkCoroutine() { return true; }
+#endif
+
+int main(void) {
+    // Creates the thread local environment and the first arena block
+    record(0);
+
+    const std::size_t before = bench::threadAllocations.count;
+    for (int i = 1; i < 100; ++i) {
+        record(i);
+    }
+    const std::size_t allocations = bench::threadAllocations.count - before;
+    std::cout << "Heap allocations for 1100 scopes: " << allocations << '\n';
+
+    std::cout << "Calibration: timer " << bench::overheadCalibration().timer
+              << "ns, nested " << bench::overheadCalibration().nested << "ns\n";
+    for (int i = 0; i < 1000; ++i) {
+        recordEmpty();
+    }
+    const bool corrected = checkCorrected(emptyName) && checkCorrected(outerName);
+    const bool allocationsRecorded = checkAllocations();
+    const bool metrics = checkMetrics();
+    const bool cpuTime = checkCpuTime();
+    const bool lock = checkLock();
+    const bool folded = checkFolded();
+    const bool histogram = checkHistogram();
+    const bool streamed = checkStreamedWithAggregated();
+    const bool context = checkContext() && checkCoroutine();
+
+    bool rates = false;
+    auto print = [&rates](const auto& out) {
+        const std::string_view json(out.data(), out.size());
+        rates = json.find("\"items_per_s\"") != json.npos
+                && json.find("\"ns_per_item\"") != json.npos
+                && json.find("\"bytes_per_s\"") != json.npos;
+        std::cout << json.substr(0, 300) << "...\n";
+    };
+    bench::getEnvInstance().flushBench(print);
+
+    return allocations == 0 && corrected && allocationsRecorded && metrics && cpuTime && lock && folded && histogram && streamed && context && rates ? 0 : 1;
+}
@@ -1,5 +1,10 @@
 #include <benchmark/benchmark.h>
 
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 struct node {
     node(char chr_, std::size_t value_, std::size_t value1_)
         : chr(chr_), value(value_), value1(value1_) {}
@@ -12,6 +17,183 @@ struct node {
     std::size_t son;
 };
 
+/*********************************************
+ *         soa_vector implementation         *
+ *********************************************/
+
+/**
+ * Describe the fields of an aggregate stored in a `soa_vector`. Every
+ * specialization must expose a `members` tuple of pointers to data members,
+ * in the order of the columns, and a `make` function building an aggregate
+ * from one value per column, in the same order.
+ *
+ * @Note an explicit list is used instead of structured bindings so that types
+ *       with user-provided constructors (like `node`) can be decomposed too.
+ */
+template <typename Aggregate>
+struct soa_fields;
+
+template <>
+struct soa_fields<node> {
+    static constexpr auto members = std::make_tuple(
+        &node::chr, &node::value, &node::value1,
+        &node::value2, &node::value3, &node::son);
+
+    static node make(char chr, std::size_t value, std::size_t value1,
+                     std::size_t value2, std::size_t value3, std::size_t son) {
+        node n(chr, value, value1);
+        n.value2 = value2;
+        n.value3 = value3;
+        n.son = son;
+        return n;
+    }
+};
+
+namespace details {
+
+template <typename MemberPtr>
+struct member_type;
+
+template <typename C, typename M>
+struct member_type<M C::*> { using type = M; };
+
+template <typename Aggregate, typename Seq>
+struct soa_columns;
+
+template <typename Aggregate, std::size_t... Is>
+struct soa_columns<Aggregate, std::index_sequence<Is...>> {
+    using type = std::tuple<std::vector<typename member_type<std::remove_const_t<
+        std::tuple_element_t<Is, decltype(soa_fields<Aggregate>::members)>>>::type>...>;
+};
+
+} // namespace details
+
+/**
+ * Contiguous view over one column of a `soa_vector`.
+ * Invalidated by any operation which reallocates the column.
+ */
+template <typename T>
+struct column_span {
+    constexpr T* begin() const { return b_; }
+    constexpr T* end() const { return b_ + n_; }
+    constexpr T* data() const { return b_; }
+    constexpr std::size_t size() const { return n_; }
+    constexpr T& operator[](std::size_t i) const { return b_[i]; }
+
+    T* b_;
+    std::size_t n_;
+};
+
+/**
+ * Store each field of `Aggregate` into its own contiguous column. A loop
+ * reading a single field only pulls that column into the cache instead of
+ * the whole (padded) structure.
+ *
+ * @Example ```
+ *      soa_vector<node> v;
+ *      v.emplace_back('a', 1, 2, 3, 4, 5);
+ *      for (std::size_t value : v.column<1>()) { // Only touches node::value
+ *          // Do stuff
+ *      }
+ *          ```
+ */
+template <typename Aggregate>
+class soa_vector {
+    static constexpr auto& members = soa_fields<Aggregate>::members;
+    static constexpr std::size_t nbFields = std::tuple_size_v<
+        std::remove_const_t<std::remove_reference_t<decltype(members)>>>;
+    using Seq = std::make_index_sequence<nbFields>;
+    using Columns = typename details::soa_columns<Aggregate, Seq>::type;
+
+public:
+    /**
+     * Proxy on the i-th row. Fields are accessed by column index and the
+     * whole row can be gathered back into an `Aggregate` (see
+     * `soa_fields::make`).
+     */
+    template <typename Vec>
+    struct row_proxy {
+        template <std::size_t I>
+        constexpr auto& get() const { return std::get<I>(vec.cols)[i]; }
+
+        Aggregate load() const { return vec.load(i, Seq{}); }
+
+        Vec& vec;
+        std::size_t i;
+    };
+
+    using row = row_proxy<soa_vector>;
+    using const_row = row_proxy<const soa_vector>;
+
+    // ---------
+    // Modifiers
+    // ---------
+    void push_back(const Aggregate& value) {
+        push_back_impl(value, Seq{});
+    }
+
+    /**
+     * Construct a row in place from one argument per column, in the order of
+     * `soa_fields<Aggregate>::members`.
+     */
+    template <typename... Args>
+    row emplace_back(Args&&... args) {
+        static_assert(sizeof...(Args) == nbFields,
+                      "emplace_back takes exactly one argument per field");
+        emplace_back_impl(std::forward_as_tuple(std::forward<Args>(args)...), Seq{});
+        return row{ *this, size() - 1 };
+    }
+
+    void reserve(std::size_t n) {
+        std::apply([n](auto&... col) { (col.reserve(n), ...); }, cols);
+    }
+
+    void clear() {
+        std::apply([](auto&... col) { (col.clear(), ...); }, cols);
+    }
+
+    // ---------
+    // Accessors
+    // ---------
+    row operator[](std::size_t i) { return row{ *this, i }; }
+    const_row operator[](std::size_t i) const { return const_row{ *this, i }; }
+
+    template <std::size_t I>
+    auto column() {
+        auto& col = std::get<I>(cols);
+        return column_span<typename std::decay_t<decltype(col)>::value_type>{
+            col.data(), col.size() };
+    }
+
+    template <std::size_t I>
+    auto column() const {
+        const auto& col = std::get<I>(cols);
+        return column_span<const typename std::decay_t<decltype(col)>::value_type>{
+            col.data(), col.size() };
+    }
+
+    std::size_t size() const { return std::get<0>(cols).size(); }
+    bool empty() const { return size() == 0; }
+
+private:
+    template <std::size_t... Is>
+    void push_back_impl(const Aggregate& value, std::index_sequence<Is...>) {
+        (std::get<Is>(cols).push_back(value.*std::get<Is>(members)), ...);
+    }
+
+    template <typename Tuple, std::size_t... Is>
+    void emplace_back_impl(Tuple&& args, std::index_sequence<Is...>) {
+        (std::get<Is>(cols).emplace_back(std::get<Is>(std::move(args))), ...);
+    }
+
+    template <std::size_t... Is>
+    Aggregate load(std::size_t i, std::index_sequence<Is...>) const {
+        return soa_fields<Aggregate>::make(std::get<Is>(cols)[i]...);
+    }
+
+    Columns cols;
+};
+
 static void BM_VectorPush(benchmark::State& state) {
   std::vector<node> v;
   v.reserve(state.range(0));
@@ -37,4 +219,126 @@ static void BM_VectorEmplace(benchmark::State& state) {
 
 BENCHMARK(BM_VectorEmplace)->Range(8, 8<<15);
 
+/*********************************************
+ *              AoS vs SoA                   *
+ *********************************************/
+
+static void BM_AoSFill(benchmark::State& state) {
+  std::vector<node> v;
+  v.reserve(state.range(0));
+  for (auto _ : state) {
+      v.clear();
+      for (std::size_t i = 0; i < state.range(0); ++i) {
+          auto& n = v.emplace_back(1, i, i + 1);
+          n.value2 = i + 2;
+          n.value3 = i + 3;
+          n.son = i + 4;
+      }
+      benchmark::DoNotOptimize(v.data());
+  }
+}
+
+BENCHMARK(BM_AoSFill)->Range(8, 8<<15);
+
+static void BM_SoAFill(benchmark::State& state) {
+  soa_vector<node> v;
+  v.reserve(state.range(0));
+  for (auto _ : state) {
+      v.clear();
+      for (std::size_t i = 0; i < state.range(0); ++i) {
+          v.emplace_back(1, i, i + 1, i + 2, i + 3, i + 4);
+      }
+      benchmark::DoNotOptimize(v.column<0>().data());
+  }
+}
+
+BENCHMARK(BM_SoAFill)->Range(8, 8<<15);
+
+static void BM_AoSScanField(benchmark::State& state) {
+  std::vector<node> v;
+  for (std::size_t i = 0; i < state.range(0); ++i) {
+      v.emplace_back(1, i, i + 1);
+  }
+
+  for (auto _ : state) {
+      std::size_t sum = 0;
+      for (const auto& n : v) {
+          sum += n.value;
+      }
+      benchmark::DoNotOptimize(sum);
+  }
+}
+
+BENCHMARK(BM_AoSScanField)->Range(8, 8<<15);
+
+static void BM_SoAScanField(benchmark::State& state) {
+  soa_vector<node> v;
+  for (std::size_t i = 0; i < state.range(0); ++i) {
+      v.emplace_back(1, i, i + 1, 0, 0, 0);
+  }
+
+  for (auto _ : state) {
+      std::size_t sum = 0;
+      for (const auto value : v.column<1>()) {
+          sum += value;
+      }
+      benchmark::DoNotOptimize(sum);
+  }
+}
+
+BENCHMARK(BM_SoAScanField)->Range(8, 8<<15);
+
+// Converting from rows: every field is scattered to its column
+static void BM_SoAPushRow(benchmark::State& state) {
+  std::vector<node> rows;
+  for (std::size_t i = 0; i < state.range(0); ++i) {
+      rows.emplace_back(1, i, i + 1);
+  }
+
+  soa_vector<node> v;
+  v.reserve(state.range(0));
+  for (auto _ : state) {
+      v.clear();
+      for (const auto& n : rows) {
+          v.push_back(n);
+      }
+      benchmark::DoNotOptimize(v.column<0>().data());
+  }
+}
+
+BENCHMARK(BM_SoAPushRow)->Range(8, 8<<15);
+
+// Reading whole rows is where the columns lose: one cache line per field
+static void BM_AoSLoadRow(benchmark::State& state) {
+  std::vector<node> v;
+  for (std::size_t i = 0; i < state.range(0); ++i) {
+      v.emplace_back(1, i, i + 1);
+  }
+
+  for (auto _ : state) {
+      for (std::size_t i = 0; i < v.size(); ++i) {
+          node n = v[i];
+          benchmark::DoNotOptimize(n);
+      }
+  }
+}
+
+BENCHMARK(BM_AoSLoadRow)->Range(8, 8<<15);
+
+static void BM_SoALoadRow(benchmark::State& state) {
+  soa_vector<node> v;
+  for (std::size_t i = 0; i < state.range(0); ++i) {
+      v.emplace_back(1, i, i + 1, i + 2, i + 3, i + 4);
+  }
+
+  for (auto _ : state) {
+      for (std::size_t i = 0; i < v.size(); ++i) {
+          node n = v[i].load();
+          benchmark::DoNotOptimize(n);
+      }
+  }
+}
+
+BENCHMARK(BM_SoALoadRow)->Range(8, 8<<15);
+
 BENCHMARK_MAIN();
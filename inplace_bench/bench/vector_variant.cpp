@@ -1,9 +1,21 @@
 #include <vector>
 #include <variant>
 #include <string>
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <benchmark/benchmark.h>
 
@@ -162,6 +174,40 @@ constexpr void switch_i(Tuple& tpl, std::size_t n, std::size_t i, Func fn) {
     }
 }
 
+template <std::size_t N, typename Tuple, typename Func>
+constexpr void switch_vec(Tuple& tpl, std::size_t n, Func fn) {
+    if constexpr (N < std::tuple_size_v<Tuple>) {
+        if (n == N) {
+            fn(std::get<N>(tpl));
+        }
+
+        switch_vec<N+1>(tpl, n, fn);
+    }
+}
+
+/**
+ * Remove from `vec` the elements matching `pred` by moving the last element
+ * into the hole. Does not preserve the order of the elements.
+ *
+ * @return the number of removed elements.
+ */
+template <typename Vec, typename Pred>
+std::size_t swap_and_pop_if(Vec& vec, Pred& pred) {
+    const std::size_t before = vec.size();
+    for (std::size_t i = 0; i < vec.size();) {
+        if (pred(vec[i])) {
+            if (i != vec.size() - 1) {
+                vec[i] = std::move(vec.back());
+            }
+            vec.pop_back();
+        } else {
+            ++i;
+        }
+    }
+
+    return before - vec.size();
+}
+
 
 } // namespace details
 
@@ -192,19 +238,68 @@ public:
         return n;
     }
 
+    /**
+     * Remove the elements matching `pred` with a single compaction pass per
+     * segment. The relative order of each type is preserved.
+     *
+     * @return the number of removed elements.
+     */
+    template <typename Pred>
+    std::size_t remove_if(Pred pred) {
+        std::size_t removed = 0;
+        details::foreach_impl<0>(vecs, [&](auto&& v) {
+            const auto it = std::remove_if(v.begin(), v.end(), std::ref(pred));
+            removed += std::distance(it, v.end());
+            v.erase(it, v.end());
+        });
+
+        return removed;
+    }
+
+    /**
+     * Same as `remove_if` but fills the holes with the last element of the
+     * segment (swap-and-pop). Faster as only removed slots are written, but
+     * the order inside each type is lost.
+     */
+    template <typename Pred>
+    std::size_t unordered_remove_if(Pred pred) {
+        std::size_t removed = 0;
+        details::foreach_impl<0>(vecs, [&](auto&& v) {
+            removed += details::swap_and_pop_if(v, pred);
+        });
+
+        return removed;
+    }
+
     std::tuple<std::vector<Ts>...> vecs;
 };
 
+/**
+ * `varvector` which remembers the insertion order of its elements.
+ *
+ * A sampled rank index is maintained along `insertionsOrder` to give O(1)
+ * access to the i-th inserted element: for every block of 64 insertions it
+ * stores, per type, the number of elements of that type inserted before the
+ * block and a bitmask of the positions taken by that type inside the block.
+ * The offset of an element in its type's vector is then the block prefix plus
+ * a popcount of the bitmask below its position.
+ *
+ * @Note the index costs `sizeof...(Ts) * 16` bytes per 64 elements, that is
+ *       0.5 bytes per element for two types, on top of the 1 byte per
+ *       element already taken by `insertionsOrder`.
+ */
 template <typename... Ts>
 struct stable_varvector : public varvector<Ts...> {
 public:
     template <typename T>
     constexpr void push_back(T&& value) {
         constexpr std::size_t val = details::find_T<T, Ts...>();
-        static_assert(val <= uint8_t(-1), "The vector cannot contain more than 255 types");
+        static_assert(val < removedMark, "The vector cannot contain more than 255 types");
 
+        auto& vec = std::get<val>(varvector<Ts...>::vecs);
+        indexInsertion(val);
         insertionsOrder.push_back(val);
-        std::get<val>(varvector<Ts...>::vecs).push_back(std::forward<T>(value));
+        vec.push_back(std::forward<T>(value));
     }
 
     template <typename Func>
@@ -221,12 +316,490 @@ public:
         }
     }
 
+    /**
+     * Resolve the i-th inserted element into the index of its type and its
+     * offset in the vector of that type.
+     */
+    std::pair<std::size_t, std::size_t> locate(std::size_t i) const {
+        const std::size_t type = insertionsOrder[i];
+        const RankBlock& block = rankIndex[i / blockSize];
+        const uint64_t below = (uint64_t(1) << (i % blockSize)) - 1;
+
+        return { type, block.prefix[type] + __builtin_popcountll(block.masks[type] & below) };
+    }
+
+    /**
+     * Call `fn` on the i-th inserted element.
+     */
+    template <typename Func>
+    void visit_at(std::size_t i, Func fn) {
+        const auto [type, offset] = locate(i);
+        details::switch_i<0>(varvector<Ts...>::vecs, type, offset, fn);
+    }
+
+    /**
+     * @return a pointer to the i-th inserted element if it is a `T`, nullptr
+     *         otherwise.
+     */
+    template <typename T>
+    T* get_if(std::size_t i) {
+        constexpr std::size_t val = details::find_T<T, Ts...>();
+        const auto [type, offset] = locate(i);
+        return type == val ? &std::get<val>(varvector<Ts...>::vecs)[offset] : nullptr;
+    }
+
+    /**
+     * Remove the elements matching `pred` while preserving the insertion
+     * order. Every segment is compacted in a single pass driven by
+     * `insertionsOrder`, which is rewritten along the way.
+     *
+     * @return the number of removed elements.
+     */
+    template <typename Pred>
+    std::size_t remove_if(Pred pred) {
+        std::size_t readIdx[sizeof...(Ts)] = { 0 };
+        std::size_t writeIdx[sizeof...(Ts)] = { 0 };
+        std::size_t out = 0;
+
+        for (const uint8_t i_vec : insertionsOrder) {
+            details::switch_vec<0>(varvector<Ts...>::vecs, i_vec, [&](auto&& v) {
+                auto& el = v[readIdx[i_vec]++];
+                if (pred(el)) {
+                    return;
+                }
+
+                if (writeIdx[i_vec] != readIdx[i_vec] - 1) {
+                    v[writeIdx[i_vec]] = std::move(el);
+                }
+                ++writeIdx[i_vec];
+                insertionsOrder[out++] = i_vec;
+            });
+        }
+
+        std::size_t t = 0;
+        details::foreach_impl<0>(varvector<Ts...>::vecs, [&](auto&& v) {
+            v.erase(v.begin() + writeIdx[t++], v.end());
+        });
+
+        const std::size_t removed = insertionsOrder.size() - out;
+        insertionsOrder.resize(out);
+        rebuildRankIndex();
+
+        return removed;
+    }
+
+    /**
+     * Remove the elements matching `pred` with swap-and-pop in each segment.
+     * The insertion order of the remaining elements is NOT preserved: the
+     * removed slots of `insertionsOrder` are dropped so that types still line
+     * up, but an element moved into a hole takes the position of the removed
+     * one.
+     *
+     * @return the number of removed elements.
+     */
+    template <typename Pred>
+    std::size_t unordered_remove_if(Pred pred) {
+        std::size_t removedPerType[sizeof...(Ts)] = { 0 };
+        std::size_t t = 0;
+        details::foreach_impl<0>(varvector<Ts...>::vecs, [&](auto&& v) {
+            removedPerType[t++] = details::swap_and_pop_if(v, pred);
+        });
+
+        // Drop the last occurrences of each type so that the k-th occurrence
+        // of a type still maps to the k-th element of its segment.
+        std::size_t removed = 0;
+        for (std::size_t i = insertionsOrder.size(); i-- > 0;) {
+            const uint8_t i_vec = insertionsOrder[i];
+            if (removedPerType[i_vec] > 0) {
+                --removedPerType[i_vec];
+                insertionsOrder[i] = removedMark;
+                ++removed;
+            }
+        }
+
+        insertionsOrder.erase(std::remove(insertionsOrder.begin(),
+                                          insertionsOrder.end(),
+                                          removedMark),
+                              insertionsOrder.end());
+        rebuildRankIndex();
+
+        return removed;
+    }
+
     void reserve(std::size_t n) {
         insertionsOrder.reserve(n);
+        rankIndex.reserve((n + blockSize - 1) / blockSize);
     }
 
+    const std::vector<uint8_t>& order() const { return insertionsOrder; }
+
 private:
+    static constexpr std::size_t blockSize = 64;
+
+    // Type index marking the slots dropped by `unordered_remove_if`
+    static constexpr uint8_t removedMark = uint8_t(-1);
+
+    struct RankBlock {
+        uint64_t prefix[sizeof...(Ts)]; // Does not wrap beyond 4G elements of a type
+        uint64_t masks[sizeof...(Ts)];
+    };
+
+    void indexInsertion(std::size_t type) {
+        const std::size_t i = insertionsOrder.size();
+        if (i % blockSize == 0) {
+            RankBlock& block = rankIndex.emplace_back();
+            std::size_t t = 0;
+            details::foreach_impl<0>(varvector<Ts...>::vecs, [&](auto&& v) {
+                block.prefix[t] = v.size();
+                block.masks[t] = 0;
+                ++t;
+            });
+        }
+
+        rankIndex.back().masks[type] |= uint64_t(1) << (i % blockSize);
+    }
+
+    void rebuildRankIndex() {
+        uint64_t counts[sizeof...(Ts)] = { 0 };
+
+        rankIndex.clear();
+        for (std::size_t i = 0; i < insertionsOrder.size(); ++i) {
+            if (i % blockSize == 0) {
+                RankBlock& block = rankIndex.emplace_back();
+                for (std::size_t t = 0; t < sizeof...(Ts); ++t) {
+                    block.prefix[t] = counts[t];
+                    block.masks[t] = 0;
+                }
+            }
+
+            const uint8_t type = insertionsOrder[i];
+            rankIndex.back().masks[type] |= uint64_t(1) << (i % blockSize);
+            ++counts[type];
+        }
+    }
+
     std::vector<uint8_t> insertionsOrder;
+    std::vector<RankBlock> rankIndex;
+};
+
+/*********************************************
+ *          varvector persistence            *
+ *********************************************/
+
+/**
+ * On-disk layout of a varvector whose types are all trivially copyable:
+ *
+ *  | VarvectorHeader | SegmentHeader * nbSegments | pad | segment 0 | pad | ...
+ *  | pad | insertions order (stable_varvector only) |
+ *
+ * Every offset is relative to the beginning of the file and every segment is
+ * aligned on the alignment of its type, so the mapping can be used in place.
+ */
+namespace persist {
+
+constexpr inline char magic[8] = { 'V', 'A', 'R', 'V', 'E', 'C', '\0', '\0' };
+constexpr inline uint32_t version = 1;
+
+struct VarvectorHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nbSegments;
+    uint64_t typeHash;
+    uint64_t orderOffset;
+    uint64_t orderSize; // 0 when saved from a plain varvector
+};
+
+struct SegmentHeader {
+    uint64_t offset;
+    uint64_t count;
+    uint32_t elemSize;
+    uint32_t align;
+};
+
+static inline uint64_t fnv1a(const char* str, uint64_t h = 14695981039346656037ull) {
+    for (; *str; ++str) {
+        h = (h ^ uint8_t(*str)) * 1099511628211ull;
+    }
+    return h;
+}
+
+// The pretty function contains the full name of `T`
+template <typename T>
+uint64_t type_hash() {
+    return fnv1a(__PRETTY_FUNCTION__) ^ (uint64_t(sizeof(T)) << 32) ^ alignof(T);
+}
+
+template <typename... Ts>
+uint64_t signature() {
+    uint64_t h = 0;
+    ((h = h * 31 + type_hash<Ts>()), ...);
+    return h;
+}
+
+static inline uint64_t align_up(uint64_t n, uint64_t align) {
+    return (n + align - 1) / align * align;
+}
+
+static inline void checked_write(FILE* f, const void* data, std::size_t n, uint64_t& pos) {
+    if (n > 0 && fwrite(data, 1, n, f) != n) {
+        throw std::system_error(errno, std::generic_category(), "fwrite");
+    }
+    pos += n;
+}
+
+static inline void pad_to(FILE* f, uint64_t offset, uint64_t& pos) {
+    static const char zeros[64] = {};
+    while (pos < offset) {
+        checked_write(f, zeros, std::min<uint64_t>(sizeof(zeros), offset - pos), pos);
+    }
+}
+
+template <typename... Ts>
+void save(const char* path, const std::tuple<std::vector<Ts>...>& vecs,
+          const std::vector<uint8_t>* order) {
+    static_assert((std::is_trivially_copyable_v<Ts> && ...),
+                  "Only trivially copyable types can be saved");
+
+    VarvectorHeader header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.nbSegments = sizeof...(Ts);
+    header.typeHash = signature<Ts...>();
+
+    // Compute the layout before writing anything
+    SegmentHeader segments[sizeof...(Ts)];
+    uint64_t offset = sizeof(VarvectorHeader) + sizeof(segments);
+    std::size_t t = 0;
+    details::foreach_impl<0>(vecs, [&](auto&& v) {
+        using T = typename std::decay_t<decltype(v)>::value_type;
+        offset = align_up(offset, alignof(T));
+        segments[t++] = { offset, v.size(), sizeof(T), alignof(T) };
+        offset += v.size() * sizeof(T);
+    });
+    header.orderOffset = offset;
+    header.orderSize = order ? order->size() : 0;
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    try {
+        uint64_t pos = 0;
+        checked_write(f, &header, sizeof(header), pos);
+        checked_write(f, segments, sizeof(segments), pos);
+
+        t = 0;
+        details::foreach_impl<0>(vecs, [&](auto&& v) {
+            using T = typename std::decay_t<decltype(v)>::value_type;
+            pad_to(f, segments[t++].offset, pos);
+            checked_write(f, v.data(), v.size() * sizeof(T), pos);
+        });
+
+        if (order) {
+            checked_write(f, order->data(), order->size(), pos);
+        }
+    } catch (...) {
+        fclose(f);
+        throw;
+    }
+
+    if (fclose(f) != 0) {
+        throw std::system_error(errno, std::generic_category(), "fclose");
+    }
+}
+
+} // namespace persist
+
+/**
+ * Write the content of `v` into `path` following the `persist` layout.
+ */
+template <typename... Ts>
+void save(const varvector<Ts...>& v, const char* path) {
+    persist::save(path, v.vecs, nullptr);
+}
+
+template <typename... Ts>
+void save(const stable_varvector<Ts...>& v, const char* path) {
+    persist::save(path, v.vecs, &v.order());
+}
+
+/**
+ * Read-only view over a file written by `save`. Opening it only maps the file
+ * and checks the headers, in O(1) plus page faults: the elements and the
+ * insertions order are paged in on first access. The insertions order is
+ * checked while it is followed, so that a corrupted file never indexes out of
+ * a segment.
+ *
+ * `foreach` follows the insertion order when the file was saved from a
+ * `stable_varvector`, the segment order otherwise.
+ *
+ * @Note the type signature stored in the file must match `Ts...` and the
+ *       layout must fit in the file, otherwise the constructor throws.
+ */
+template <typename... Ts>
+class mapped_varvector {
+public:
+    explicit mapped_varvector(const char* path) {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            const int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat");
+        }
+
+        _size = st.st_size;
+        if (_size == 0) {
+            close(fd);
+            throw std::runtime_error("Not a varvector file");
+        }
+        _base = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        const int err = errno;
+        close(fd);
+        if (_base == MAP_FAILED) {
+            throw std::system_error(err, std::generic_category(), "mmap");
+        }
+
+        try {
+            checkHeader();
+        } catch (...) {
+            munmap(_base, _size);
+            throw;
+        }
+    }
+
+    ~mapped_varvector() { munmap(_base, _size); }
+
+    mapped_varvector(const mapped_varvector&) = delete;
+    mapped_varvector(mapped_varvector&&) = delete;
+    mapped_varvector& operator=(const mapped_varvector&) = delete;
+    mapped_varvector& operator=(mapped_varvector&&) = delete;
+
+    template <typename Func>
+    void foreach(Func fn) const {
+        if (header().orderSize == 0) {
+            foreachSegment<0>(fn);
+            return;
+        }
+
+        std::size_t curIdx[sizeof...(Ts)] = { 0 };
+        uint64_t counts[sizeof...(Ts)];
+        for (uint32_t t = 0; t < sizeof...(Ts); ++t) {
+            counts[t] = segments()[t].count;
+        }
+        const uint8_t* order = bytes() + header().orderOffset;
+        for (uint64_t i = 0; i < header().orderSize; ++i) {
+            const uint8_t i_vec = order[i];
+            if (i_vec >= sizeof...(Ts) || curIdx[i_vec] >= counts[i_vec]) {
+                throw std::runtime_error("Corrupted varvector insertions order");
+            }
+            switchAt<0>(i_vec, curIdx[i_vec]++, fn);
+        }
+    }
+
+    std::size_t size() const {
+        std::size_t n = 0;
+        for (uint32_t t = 0; t < sizeof...(Ts); ++t) {
+            n += segments()[t].count;
+        }
+        return n;
+    }
+
+private:
+    using Types = std::tuple<Ts...>;
+
+    const uint8_t* bytes() const { return static_cast<const uint8_t*>(_base); }
+    const persist::VarvectorHeader& header() const {
+        return *reinterpret_cast<const persist::VarvectorHeader*>(_base);
+    }
+    const persist::SegmentHeader* segments() const {
+        return reinterpret_cast<const persist::SegmentHeader*>(bytes() + sizeof(persist::VarvectorHeader));
+    }
+
+    template <std::size_t N>
+    const std::tuple_element_t<N, Types>* segment() const {
+        return reinterpret_cast<const std::tuple_element_t<N, Types>*>(bytes() + segments()[N].offset);
+    }
+
+    template <std::size_t N, typename Func>
+    void foreachSegment(Func& fn) const {
+        if constexpr (N < sizeof...(Ts)) {
+            const auto* seg = segment<N>();
+            for (uint64_t i = 0; i < segments()[N].count; ++i) {
+                fn(seg[i]);
+            }
+            foreachSegment<N+1>(fn);
+        }
+    }
+
+    template <std::size_t N, typename Func>
+    void switchAt(std::size_t n, std::size_t i, Func& fn) const {
+        if constexpr (N < sizeof...(Ts)) {
+            if (n == N) {
+                fn(segment<N>()[i]);
+            }
+            switchAt<N+1>(n, i, fn);
+        }
+    }
+
+    void checkHeader() const {
+        const uint64_t headersSize = sizeof(persist::VarvectorHeader)
+                                   + sizeof(persist::SegmentHeader) * sizeof...(Ts);
+        if (_size < headersSize
+            || memcmp(header().magic, persist::magic, sizeof(persist::magic)) != 0) {
+            throw std::runtime_error("Not a varvector file");
+        }
+        if (header().version != persist::version) {
+            throw std::runtime_error("Unsupported varvector file version");
+        }
+        if (header().nbSegments != sizeof...(Ts)
+            || header().typeHash != persist::signature<Ts...>()) {
+            throw std::runtime_error("Varvector file types mismatch");
+        }
+
+        // The type hash covers the sizes and alignments, but not the headers
+        constexpr uint32_t elemSizes[] = { uint32_t(sizeof(Ts))... };
+        constexpr uint32_t aligns[] = { uint32_t(alignof(Ts))... };
+        for (uint32_t t = 0; t < sizeof...(Ts); ++t) {
+            const auto& seg = segments()[t];
+            if (seg.elemSize != elemSizes[t] || seg.align != aligns[t]) {
+                throw std::runtime_error("Varvector segment layout mismatch");
+            }
+
+            uint64_t bytes;
+            uint64_t end;
+            if (seg.offset % seg.align != 0
+                || __builtin_mul_overflow(seg.count, uint64_t(seg.elemSize), &bytes)
+                || __builtin_add_overflow(seg.offset, bytes, &end)
+                || end > _size) {
+                throw std::runtime_error("Corrupted varvector segment");
+            }
+        }
+
+        uint64_t orderEnd;
+        if (__builtin_add_overflow(header().orderOffset, header().orderSize, &orderEnd)
+            || orderEnd > _size) {
+            throw std::runtime_error("Corrupted varvector insertions order");
+        }
+
+        // Each type is bounded while iterating, see `foreach`: with the same
+        // total, every element then appears once
+        uint64_t total = 0;
+        for (uint32_t t = 0; t < sizeof...(Ts); ++t) {
+            total += segments()[t].count;
+        }
+        if (header().orderSize != 0 && header().orderSize != total) {
+            throw std::runtime_error("Varvector insertions order does not match the segments");
+        }
+    }
+
+    void* _base;
+    std::size_t _size;
 };
 
 static inline void init_vec(std::vector<IShape*>& dst, const std::size_t n) {
@@ -325,4 +898,213 @@ static void BM_StableVarvectorIterate(benchmark::State& state) {
 
 BENCHMARK(BM_StableVarvectorIterate)->Range(8, 8<<15);
 
+static void BM_StableVarvectorVisitAt(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> v;
+  init_vec(v, state.range(0));
+
+  srand(42);
+  std::vector<std::size_t> indices(1024);
+  for (auto& i : indices) {
+      i = rand() % state.range(0);
+  }
+
+  for (auto _ : state) {
+      for (const std::size_t i : indices) {
+          v.visit_at(i, [](auto&& el) {
+            el.perimeter();
+          });
+      }
+  }
+  state.SetItemsProcessed(state.iterations() * indices.size());
+}
+
+BENCHMARK(BM_StableVarvectorVisitAt)->Range(8, 8<<15);
+
+static void BM_StableVarvectorScanAt(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> v;
+  init_vec(v, state.range(0));
+
+  srand(42);
+  std::vector<std::size_t> indices(1024);
+  for (auto& i : indices) {
+      i = rand() % state.range(0);
+  }
+
+  for (auto _ : state) {
+      for (const std::size_t i : indices) {
+          // Previous way to reach the i-th element: walk the insertion order
+          std::size_t cur = 0;
+          v.foreach([&](auto&& el) {
+            if (cur++ == i) {
+                el.perimeter();
+            }
+          });
+      }
+  }
+  state.SetItemsProcessed(state.iterations() * indices.size());
+}
+
+BENCHMARK(BM_StableVarvectorScanAt)->Range(8, 8<<12);
+
+static std::size_t shape_id(const CRTPTriangle& t) { return t.a; }
+static std::size_t shape_id(const CRTPSquare& s) { return s.side; }
+
+// Select `percent`% of the elements, spread over the whole vector
+static inline auto expired(std::size_t percent) {
+  return [percent](const auto& el) {
+      return (shape_id(el) * 2654435761u) % 100 < percent;
+  };
+}
+
+// Delete 1%, 10% and 50% of the elements
+static void removal_args(benchmark::internal::Benchmark* b) {
+  for (const int n : { 8<<10, 8<<15 }) {
+      for (const int percent : { 1, 10, 50 }) {
+          b->Args({ n, percent });
+      }
+  }
+}
+
+static void BM_VarvectorRemoveIf(benchmark::State& state) {
+  varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  for (auto _ : state) {
+      state.PauseTiming();
+      auto v = ref;
+      state.ResumeTiming();
+
+      benchmark::DoNotOptimize(v.remove_if(expired(state.range(1))));
+  }
+}
+
+BENCHMARK(BM_VarvectorRemoveIf)->Apply(removal_args);
+
+static void BM_VarvectorUnorderedRemoveIf(benchmark::State& state) {
+  varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  for (auto _ : state) {
+      state.PauseTiming();
+      auto v = ref;
+      state.ResumeTiming();
+
+      benchmark::DoNotOptimize(v.unordered_remove_if(expired(state.range(1))));
+  }
+}
+
+BENCHMARK(BM_VarvectorUnorderedRemoveIf)->Apply(removal_args);
+
+static void BM_StableVarvectorRemoveIf(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  for (auto _ : state) {
+      state.PauseTiming();
+      auto v = ref;
+      state.ResumeTiming();
+
+      benchmark::DoNotOptimize(v.remove_if(expired(state.range(1))));
+  }
+}
+
+BENCHMARK(BM_StableVarvectorRemoveIf)->Apply(removal_args);
+
+static void BM_StableVarvectorUnorderedRemoveIf(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  for (auto _ : state) {
+      state.PauseTiming();
+      auto v = ref;
+      state.ResumeTiming();
+
+      benchmark::DoNotOptimize(v.unordered_remove_if(expired(state.range(1))));
+  }
+}
+
+BENCHMARK(BM_StableVarvectorUnorderedRemoveIf)->Apply(removal_args);
+
+static void BM_StableVarvectorRebuild(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  const auto pred = expired(state.range(1));
+  for (auto _ : state) {
+      stable_varvector<CRTPTriangle, CRTPSquare> v;
+      ref.foreach([&](auto&& el) {
+        if (!pred(el)) {
+            v.push_back(std::decay_t<decltype(el)>(el));
+        }
+      });
+      benchmark::DoNotOptimize(v);
+  }
+}
+
+BENCHMARK(BM_StableVarvectorRebuild)->Apply(removal_args);
+
+static const char* saved_path = "/tmp/vector_variant.varvec";
+
+static void BM_StartupRebuild(benchmark::State& state) {
+  for (auto _ : state) {
+      stable_varvector<CRTPTriangle, CRTPSquare> v;
+      init_vec(v, state.range(0));
+      v.foreach([](auto&& el) {
+        el.perimeter();
+      });
+  }
+}
+
+BENCHMARK(BM_StartupRebuild)->Range(8<<10, 8<<18);
+
+static void BM_StartupMmapWarm(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  save(ref, saved_path);
+
+  for (auto _ : state) {
+      mapped_varvector<CRTPTriangle, CRTPSquare> v(saved_path);
+      v.foreach([](auto&& el) {
+        el.perimeter();
+      });
+  }
+  unlink(saved_path);
+}
+
+BENCHMARK(BM_StartupMmapWarm)->Range(8<<10, 8<<18);
+
+static void BM_StartupMmapCold(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  save(ref, saved_path);
+
+  for (auto _ : state) {
+      state.PauseTiming();
+      // Evict the file from the page cache (best effort, needs the pages to be clean)
+      const int fd = open(saved_path, O_RDONLY);
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+      state.ResumeTiming();
+
+      mapped_varvector<CRTPTriangle, CRTPSquare> v(saved_path);
+      v.foreach([](auto&& el) {
+        el.perimeter();
+      });
+  }
+  unlink(saved_path);
+}
+
+BENCHMARK(BM_StartupMmapCold)->Range(8<<10, 8<<18);
+
+// Mapping alone, without touching the elements
+static void BM_StartupMmapOpen(benchmark::State& state) {
+  stable_varvector<CRTPTriangle, CRTPSquare> ref;
+  init_vec(ref, state.range(0));
+  save(ref, saved_path);
+
+  for (auto _ : state) {
+      mapped_varvector<CRTPTriangle, CRTPSquare> v(saved_path);
+      benchmark::DoNotOptimize(v.size());
+  }
+  unlink(saved_path);
+}
+
+BENCHMARK(BM_StartupMmapOpen)->Range(8<<10, 8<<18);
+
 BENCHMARK_MAIN();